@@ -0,0 +1,94 @@
+#pragma once
+/* Runs the CPU side of asset loading on a thread pool and times each asset
+*  Decoding (OBJ parsing, vertex building, image decoding) is queued with load(),
+*  the GL upload that follows on the main thread is timed with upload().
+*/
+class AssetLoader {
+private:
+    struct Timing {
+        std::string name;
+        double decodeMs = 0;
+        double uploadMs = 0;
+    };
+
+    ThreadPool pool;
+    std::mutex timingMutex;
+    std::vector<Timing> timings;
+    std::chrono::steady_clock::time_point start;
+
+    static double elapsedMs(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - since).count();
+    }
+
+    /* Returns timing entry of an asset, creating it on first use */
+    Timing& getTiming(std::string name) {
+        for (Timing& timing : timings)
+            if (timing.name == name)
+                return timing;
+        timings.push_back(Timing());
+        timings.back().name = name;
+        return timings.back();
+    }
+
+public:
+    AssetLoader() {
+        start = std::chrono::steady_clock::now();
+    }
+
+    /* Queues CPU loading of an asset on a worker thread
+    *  @param name - asset name used in the timing report
+    *  @param task - loading work, must not make GL calls
+    *  @returns future holding the result of the task
+    */
+    template <typename F>
+    auto load(std::string name, F task) -> std::future<decltype(task())> {
+        {
+            std::lock_guard<std::mutex> lock(timingMutex);
+            getTiming(name);
+        }
+        return pool.submit([this, name, task]() mutable {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            struct Record {
+                AssetLoader* loader;
+                std::string name;
+                std::chrono::steady_clock::time_point begin;
+                ~Record() {
+                    std::lock_guard<std::mutex> lock(loader->timingMutex);
+                    loader->getTiming(name).decodeMs = elapsedMs(begin);
+                }
+            } record{ this, name, begin };
+            return task();
+        });
+    }
+
+    /* Runs GL upload of an asset on the calling thread
+    *  @param name - asset name used in the timing report
+    *  @param task - upload work
+    */
+    template <typename F>
+    void upload(std::string name, F task) {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        task();
+        double ms = elapsedMs(begin);
+
+        std::lock_guard<std::mutex> lock(timingMutex);
+        getTiming(name).uploadMs += ms;
+    }
+
+    /* Prints per-asset decode and upload times, and total load time */
+    void report() {
+        std::lock_guard<std::mutex> lock(timingMutex);
+        double slowest = 0, sum = 0;
+        std::cout << "Asset load times (" << pool.getThreadCount() << " worker threads)" << std::endl;
+        for (Timing& timing : timings) {
+            std::cout << "  " << timing.name
+                << ": decode " << timing.decodeMs << " ms"
+                << ", upload " << timing.uploadMs << " ms" << std::endl;
+            slowest = std::max(slowest, timing.decodeMs);
+            sum += timing.decodeMs + timing.uploadMs;
+        }
+        std::cout << "  Slowest asset: " << slowest << " ms, serial sum: " << sum << " ms"
+            << ", total: " << elapsedMs(start) << " ms" << std::endl;
+    }
+};
@@ -0,0 +1,260 @@
+#pragma once
+/* Read-only archive of baked meshes, textures and shader sources
+*  A pack is one file written by the packer (packer.cpp) with a header, a
+*  table of contents, a name block and the data of every entry, each aligned
+*  to 64 bytes so it can be used straight from the mapping. Meshes are mesh
+*  cache images, textures are decoded pixels followed by their mip levels and
+*  shaders are source text.
+*
+*  The pack is mapped once and mounted for the whole process, loaders look up
+*  assets by their relative path and fall back to loose files for anything the
+*  pack does not hold. Mount before starting worker threads, lookups are safe
+*  from any thread afterwards.
+*/
+class AssetPack {
+public:
+    enum Type : uint32_t { MESH = 1, TEXTURE = 2, SHADER = 3 };
+
+    /* Table of contents entry */
+    struct Entry {
+        uint32_t type;
+        uint32_t nameOffset;    // Byte offset into the name block
+        uint32_t nameSize;
+        // Floats per vertex of meshes, channels of textures
+        uint32_t layout;
+        // Size of the first texture level, number of levels and whether rows start at the bottom
+        uint32_t width, height;
+        uint32_t levels;
+        uint32_t flipped;
+        uint64_t dataStart;     // Byte offset of data from start of file
+        uint64_t dataSize;
+    };
+
+    /* Entry found in the pack, data stays valid while mapping is held */
+    struct Asset {
+        const Entry* entry = nullptr;
+        const unsigned char* data = nullptr;
+        std::shared_ptr<MappedFile> mapping;
+    };
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t reserved;
+        uint64_t tocStart;      // Byte offset of entryCount entries
+        uint64_t nameStart;     // Byte offset of entry names, not terminated
+        uint64_t nameSize;
+    };
+
+    // Bump when the layout of the pack or of its entries changes
+    static const uint32_t VERSION = 1;
+    static const uint64_t ALIGNMENT = 64;
+
+    std::shared_ptr<MappedFile> file;
+    const Entry* entries = nullptr;
+    uint32_t entryCount = 0;
+    // Entries by normalized name, a mesh may be baked once per vertex layout
+    std::unordered_multimap<std::string, uint32_t> lookup;
+
+    static uint64_t align(uint64_t value) {
+        return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+public:
+    AssetPack() {}
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+
+    /* Returns the pack loaders look assets up in */
+    static AssetPack& getMounted() {
+        static AssetPack mounted;
+        return mounted;
+    }
+
+    /* Maps a pack and makes it the one loaders look assets up in
+    *  @param path - pack file
+    *  @returns true if the pack was mapped and is valid
+    */
+    static bool mount(std::string path) {
+        return getMounted().open(path);
+    }
+
+    /* Lowercases and unifies separators so lookups match paths written on any platform */
+    static std::string normalizeName(std::string name) {
+        for (char& c : name)
+            c = c == '\\' ? '/' : (char)std::tolower((unsigned char)c);
+        while (name.compare(0, 2, "./") == 0)
+            name.erase(0, 2);
+        return name;
+    }
+
+    /* Maps and validates a pack
+    *  @param path - pack file
+    *  @returns true if the pack is valid, otherwise the pack is left empty
+    */
+    bool open(std::string path) {
+        close();
+        std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
+        if (!mapped->map(path) || mapped->getSize() < sizeof(Header))
+            return false;
+
+        const unsigned char* data = mapped->getData();
+        uint64_t size = mapped->getSize();
+        const Header* header = (const Header*)data;
+        if (memcmp(header->magic, "MCOP", 4) != 0 || header->version != VERSION)
+            return false;
+        uint64_t tocSize = (uint64_t)header->entryCount * sizeof(Entry);
+        if (header->tocStart < sizeof(Header) || header->tocStart % ALIGNMENT != 0 || header->tocStart + tocSize > size ||
+            header->nameStart < header->tocStart + tocSize || header->nameStart + header->nameSize > size)
+            return false;
+
+        const Entry* toc = (const Entry*)(data + header->tocStart);
+        const char* names = (const char*)(data + header->nameStart);
+        for (uint32_t i = 0; i < header->entryCount; i++) {
+            const Entry& entry = toc[i];
+            if ((uint64_t)entry.nameOffset + entry.nameSize > header->nameSize ||
+                entry.dataStart % ALIGNMENT != 0 || entry.dataStart + entry.dataSize > size) {
+                lookup.clear();
+                return false;
+            }
+            lookup.insert(std::make_pair(std::string(names + entry.nameOffset, entry.nameSize), i));
+        }
+
+        file = mapped;
+        entries = toc;
+        entryCount = header->entryCount;
+        return true;
+    }
+
+    /* Unmaps the pack, assets found earlier keep their own reference to the mapping */
+    void close() {
+        file.reset();
+        entries = nullptr;
+        entryCount = 0;
+        lookup.clear();
+    }
+
+    /* Looks up an asset
+    *  @param name - path of the loose file the asset was baked from
+    *  @param type - kind of asset
+    *  @param asset - receives the entry and its data
+    *  @param layout (optional) - required floats per vertex or channels, 0 for any
+    *  @returns true if the pack holds the asset
+    */
+    bool find(std::string name, Type type, Asset& asset, uint32_t layout = 0) {
+        if (!file)
+            return false;
+
+        typedef std::unordered_multimap<std::string, uint32_t>::iterator Iterator;
+        std::pair<Iterator, Iterator> range = lookup.equal_range(normalizeName(name));
+        for (Iterator it = range.first; it != range.second; ++it) {
+            const Entry& entry = entries[it->second];
+            if (entry.type != type || (layout != 0 && entry.layout != layout))
+                continue;
+            asset.entry = &entry;
+            asset.data = file->getData() + entry.dataStart;
+            asset.mapping = file;
+            return true;
+        }
+        return false;
+    }
+
+    /* Getters */
+    bool isMounted() {
+        return file != nullptr;
+    }
+    size_t getEntryCount() {
+        return entryCount;
+    }
+    size_t getSize() {
+        return file ? file->getSize() : 0;
+    }
+
+    /* Writes a pack, entries are streamed to the file as they are added */
+    class Writer {
+    private:
+        std::ofstream out;
+        std::string path, tempPath;
+        std::vector<Entry> toc;
+        std::string names;
+        uint64_t position = 0;
+
+        void pad() {
+            static const char padding[ALIGNMENT] = {};
+            uint64_t aligned = align(position);
+            out.write(padding, aligned - position);
+            position = aligned;
+        }
+
+    public:
+        /* Starts writing a pack to a temporary file next to path */
+        bool open(std::string path) {
+            this->path = path;
+            tempPath = path + ".tmp";
+            out.open(tempPath, std::ios::binary | std::ios::trunc);
+
+            // Header is rewritten once the table of contents is known
+            Header header = {};
+            out.write((const char*)&header, sizeof(Header));
+            position = sizeof(Header);
+            return (bool)out;
+        }
+
+        /* Appends an entry
+        *  @param entry - type, layout and texture fields, offsets are filled in
+        *  @param name - path of the loose file the asset was baked from
+        *  @param data - entry data
+        *  @param size - size of data in bytes
+        */
+        void add(Entry entry, std::string name, const void* data, size_t size) {
+            pad();
+            name = normalizeName(name);
+            entry.nameOffset = (uint32_t)names.size();
+            entry.nameSize = (uint32_t)name.size();
+            entry.dataStart = position;
+            entry.dataSize = size;
+            names += name;
+            toc.push_back(entry);
+
+            out.write((const char*)data, size);
+            position += size;
+        }
+
+        /* Writes the table of contents and replaces the pack at path
+        *  @returns true if the whole pack was written
+        */
+        bool finish() {
+            pad();
+            Header header = {};
+            memcpy(header.magic, "MCOP", 4);
+            header.version = VERSION;
+            header.entryCount = (uint32_t)toc.size();
+            header.tocStart = position;
+            header.nameStart = position + toc.size() * sizeof(Entry);
+            header.nameSize = names.size();
+
+            out.write((const char*)toc.data(), toc.size() * sizeof(Entry));
+            out.write(names.data(), names.size());
+            out.seekp(0);
+            out.write((const char*)&header, sizeof(Header));
+            out.close();
+            if (!out) {
+                std::remove(tempPath.c_str());
+                return false;
+            }
+
+            std::remove(path.c_str());
+            return std::rename(tempPath.c_str(), path.c_str()) == 0;
+        }
+
+        /* Getters */
+        size_t getEntryCount() {
+            return toc.size();
+        }
+        uint64_t getSize() {
+            return position + toc.size() * sizeof(Entry) + names.size();
+        }
+    };
+};
@@ -1,5 +1,11 @@
 #pragma once
-
+/* Base of the cameras, caches its matrices and frustum planes
+*  View, view-projection and the planes are rebuilt on the first get after a
+*  setter or camera movement changed the position, target, up or projection,
+*  so cameras that stay still cost nothing per frame. The projection and
+*  planes use -1 to 1 depth for culling and picking, the render matrices the
+*  depth convention of the RenderTarget, and are rebuilt if it changes.
+*/
 class Camera {
 protected:
 	glm::vec3 position = glm::vec3(0, 0, 0);
@@ -7,6 +13,41 @@ protected:
 	glm::vec3 worldUp = glm::vec3(0, 1, 0);
 	glm::mat4 projection;
 
+	// Matrices and planes derived from the fields above, stale while dirty
+	glm::mat4 view = glm::mat4(1.f);
+	glm::mat4 viewProjection = glm::mat4(1.f);
+	glm::mat4 renderProjection = glm::mat4(1.f);
+	glm::mat4 renderViewProjection = glm::mat4(1.f);
+	glm::vec4 frustumPlanes[6];
+	RenderTarget::Convention convention = RenderTarget::STANDARD;
+	bool dirty = true;
+
+	/* Marks the cached matrices stale after the camera moved */
+	void markDirty() {
+		dirty = true;
+	}
+
+	/* Returns the projection with -1 to 1 depth, kept as set unless a camera overrides it
+	*  @param infiniteFar - reversed depth is in use, so the far plane may be dropped
+	*/
+	virtual glm::mat4 makeProjection(bool /*infiniteFar*/) {
+		return projection;
+	}
+
+	/* Rebuilds the cached matrices and planes if the camera or the depth convention changed */
+	void update() {
+		if (!dirty && convention == RenderTarget::getConvention())
+			return;
+		convention = RenderTarget::getConvention();
+		projection = makeProjection(RenderTarget::isReversed());
+		renderProjection = RenderTarget::remapProjection(projection);
+		view = glm::lookAt(position, target, worldUp);
+		viewProjection = projection * view;
+		renderViewProjection = renderProjection * view;
+		FrustumCuller::extractPlanes(viewProjection, frustumPlanes);
+		dirty = false;
+	}
+
 public:
 	Camera() {
 		position = glm::vec3(0);
@@ -14,27 +55,51 @@ public:
 		worldUp = glm::vec3(0);
 		projection = glm::mat4(0);
 	}
+	virtual ~Camera() {}
 
 	/* Getters */
 	glm::vec3 getPosition() {
 		return position;
 	}
-	glm::mat4 getProjection() {
+	const glm::mat4& getProjection() {
+		update();
 		return projection;
 	}
-	glm::mat4 getViewMatrix() {
-		return glm::lookAt(position, target, worldUp);
+	const glm::mat4& getViewMatrix() {
+		update();
+		return view;
+	}
+	const glm::mat4& getViewProjection() {
+		update();
+		return viewProjection;
+	}
+	// Matrices drawing with the depth convention of the RenderTarget
+	const glm::mat4& getRenderProjection() {
+		update();
+		return renderProjection;
+	}
+	const glm::mat4& getRenderViewProjection() {
+		update();
+		return renderViewProjection;
+	}
+	// Left, right, bottom, top, near, far, in the layout FrustumCuller::setPlanes takes
+	const glm::vec4* getFrustumPlanes() {
+		update();
+		return frustumPlanes;
 	}
 
 	/* Setters */
 	void setPos(glm::vec3 position) {
 		this->position = position;
+		markDirty();
 	}
 	void setTarget(glm::vec3 target) {
 		this->target = target;
+		markDirty();
 	}
 	void setWorldUp(glm::vec3 worldUp) {
 		this->worldUp = worldUp;
+		markDirty();
 	}
 
 	/* Methods */
@@ -43,5 +108,6 @@ public:
 	*/
 	void modPos(glm::vec3 val) {
 		position += val;
+		markDirty();
 	}
 };
\ No newline at end of file
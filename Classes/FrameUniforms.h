@@ -0,0 +1,117 @@
+#pragma once
+/* Uniform buffer holding the camera and lights of a frame for all programs
+*  The FrameData and Lights blocks are two ranges of one buffer, bound to the
+*  fixed binding points ShaderManager assigns to those block names. The whole
+*  buffer is uploaded with one call per frame instead of sending each field
+*  to each program. Structs mirror the std140 layout of the shader blocks.
+*/
+class FrameUniforms {
+public:
+    struct FrameData {
+        glm::mat4 projection;
+        glm::mat4 view;
+        // Cached by the camera, so vertices skip the projection * view product
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPos;
+        float padding;
+    };
+
+    struct DirectionLightData {
+        glm::vec3 direction;
+        float strength;
+        glm::vec3 color;
+        float ambientStr;
+        glm::vec3 ambientColor;
+        float specStr;
+        float specPhong;
+        float padding[3];
+    };
+
+    struct PointLightData {
+        glm::vec3 position;
+        float linear;
+        glm::vec3 color;
+        float quadratic;
+        glm::vec3 ambientColor;
+        float ambientStr;
+        float specStr;
+        float specPhong;
+        float padding[2];
+    };
+
+    struct LightsData {
+        DirectionLightData directionLight;
+        PointLightData pointLight;
+    };
+
+    static_assert(sizeof(FrameData) == 208, "FrameData must match its std140 block");
+    static_assert(sizeof(DirectionLightData) == 64 && sizeof(PointLightData) == 64,
+        "Light structs must match their std140 layout");
+
+private:
+    GLBuffer buffer;
+    // Byte offset of the Lights range, aligned for glBindBufferRange
+    GLintptr lightsOffset = 0;
+    std::vector<unsigned char> staging;
+
+public:
+    FrameUniforms() {}
+
+    /* Creates the buffer and binds both ranges, call on the GL thread */
+    void initBuffers() {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        lightsOffset = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+        staging.assign(lightsOffset + sizeof(LightsData), 0);
+
+        buffer = GLBuffer::generate();
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+        glBufferData(GL_UNIFORM_BUFFER, staging.size(), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, ShaderManager::FRAME_DATA_BINDING, buffer.get(), 0, sizeof(FrameData));
+        glBindBufferRange(GL_UNIFORM_BUFFER, ShaderManager::LIGHTS_BINDING, buffer.get(), lightsOffset, sizeof(LightsData));
+    }
+
+    /* Uploads camera and lights of this frame
+    *  @param camera - active camera, its cached matrices are copied
+    *  @param directionLight - scene light
+    *  @param pointLight - player flashlight
+    */
+    void update(Camera& camera, DirectionLight directionLight, PointLight pointLight) {
+        FrameData* frame = (FrameData*)staging.data();
+        frame->projection = camera.getRenderProjection();
+        frame->view = camera.getViewMatrix();
+        frame->viewProjection = camera.getRenderViewProjection();
+        frame->cameraPos = camera.getPosition();
+
+        LightsData* lights = (LightsData*)(staging.data() + lightsOffset);
+        lights->directionLight.direction = directionLight.getDirection();
+        lights->directionLight.strength = directionLight.getIntensity();
+        lights->directionLight.color = directionLight.getColor();
+        lights->directionLight.ambientStr = directionLight.getAmbientStr();
+        lights->directionLight.ambientColor = directionLight.getAmbientColor();
+        lights->directionLight.specStr = directionLight.getSpecStr();
+        lights->directionLight.specPhong = directionLight.getSpecPhong();
+
+        lights->pointLight.position = pointLight.getPos();
+        lights->pointLight.linear = pointLight.getLinear();
+        lights->pointLight.color = pointLight.getColor();
+        lights->pointLight.quadratic = pointLight.getQuadratic();
+        lights->pointLight.ambientColor = pointLight.getAmbientColor();
+        lights->pointLight.ambientStr = pointLight.getAmbientStr();
+        lights->pointLight.specStr = pointLight.getSpecStr();
+        lights->pointLight.specPhong = pointLight.getSpecPhong();
+
+        // Orphans the previous contents so the upload does not wait for frames still reading them
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+        glBufferData(GL_UNIFORM_BUFFER, staging.size(), staging.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        ShaderManager::getCallCounts().blockUpdates++;
+    }
+
+    /* Deletion of buffer after use */
+    void cleanup() {
+        buffer.reset();
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+/* Tests bounding volumes against the view frustum of a camera
+*  The six planes are extracted from projection * view, so perspective and
+*  orthographic cameras are handled alike. Bounding spheres are stored one
+*  array per component and tested four at a time with SSE where it is
+*  available; a sphere is culled if it lies fully behind any plane. Boxes can
+*  refine what a sphere test lets through.
+*/
+class FrustumCuller {
+public:
+    /* World space bounding spheres, one array per component */
+    struct SphereSet {
+        std::vector<float> x, y, z, radius;
+
+        /* @param sphere - center in xyz, radius in w */
+        void add(glm::vec4 sphere) {
+            x.push_back(sphere.x);
+            y.push_back(sphere.y);
+            z.push_back(sphere.z);
+            radius.push_back(sphere.w);
+        }
+        void clear() {
+            x.clear();
+            y.clear();
+            z.clear();
+            radius.clear();
+        }
+        size_t size() const {
+            return x.size();
+        }
+    };
+
+    /* Where a box lies relative to the frustum */
+    enum Containment { OUTSIDE, INTERSECTING, INSIDE };
+
+    /* Volumes tested and let through since the stats were last reset */
+    struct Stats {
+        size_t tested = 0;
+        size_t visible = 0;
+    };
+
+private:
+    // Left, right, bottom, top, near, far as normal in xyz and distance in w, normals point inside
+    glm::vec4 planes[6];
+    Stats stats;
+
+    /* Returns true if a sphere is in front of or crossing every plane */
+    bool testSphere(float x, float y, float z, float radius) const {
+        for (int p = 0; p < 6; p++)
+            if (planes[p].x * x + planes[p].y * y + planes[p].z * z + planes[p].w < -radius)
+                return false;
+        return true;
+    }
+
+#ifdef USE_SSE
+    /* Tests spheres four at a time, writes a flag per sphere and returns how many are visible */
+    size_t testSpheresSse(const SphereSet& spheres, size_t count, unsigned char* visible) const {
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; p++) {
+            planeX[p] = _mm_set1_ps(planes[p].x);
+            planeY[p] = _mm_set1_ps(planes[p].y);
+            planeZ[p] = _mm_set1_ps(planes[p].z);
+            planeW[p] = _mm_set1_ps(planes[p].w);
+        }
+
+        size_t visibleCount = 0;
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(&spheres.x[i]);
+            __m128 y = _mm_loadu_ps(&spheres.y[i]);
+            __m128 z = _mm_loadu_ps(&spheres.z[i]);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                    _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (int lane = 0; lane < 4; lane++) {
+                visible[i + lane] = (unsigned char)(mask >> lane & 1);
+                visibleCount += mask >> lane & 1;
+            }
+        }
+
+        // Remaining spheres one at a time
+        for (; i < count; i++) {
+            visible[i] = testSphere(spheres.x[i], spheres.y[i], spheres.z[i], spheres.radius[i]);
+            visibleCount += visible[i];
+        }
+        return visibleCount;
+    }
+#endif
+
+public:
+    FrustumCuller() {
+        setViewProjection(glm::mat4(1.f));
+    }
+
+    /* Returns true if the SSE path is compiled in */
+    static bool hasSimd() {
+#ifdef USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* Extracts the normalized frustum planes of a camera, normals pointing inside
+    *  @param viewProjection - projection * view of the camera
+    *  @param planes - receives left, right, bottom, top, near and far
+    */
+    static void extractPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+        // Rows of the matrix, glm stores columns
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++)
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+
+        for (int axis = 0; axis < 3; axis++) {
+            planes[axis * 2] = rows[3] + rows[axis];
+            planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+
+        // Normalized so plane distances are world units, comparable with radii
+        for (int p = 0; p < 6; p++) {
+            float length = glm::length(glm::vec3(planes[p]));
+            if (length > 0.f)
+                planes[p] /= length;
+        }
+    }
+
+    /* Extracts the frustum planes of a camera
+    *  @param viewProjection - projection * view of the camera
+    */
+    void setViewProjection(const glm::mat4& viewProjection) {
+        extractPlanes(viewProjection, planes);
+    }
+
+    /* Takes planes already extracted, such as those a camera caches
+    *  @param frustumPlanes - left, right, bottom, top, near and far
+    */
+    void setPlanes(const glm::vec4* frustumPlanes) {
+        std::copy(frustumPlanes, frustumPlanes + 6, planes);
+    }
+
+    /* Tests spheres against the frustum
+    *  @param spheres - world space bounding spheres
+    *  @param visible - resized to one flag per sphere, 1 if it may be visible
+    *  @param useSimd (optional) - use SSE if compiled in, otherwise scalar code
+    *  @returns number of visible spheres
+    */
+    size_t cullSpheres(const SphereSet& spheres, std::vector<unsigned char>& visible, bool useSimd = true) {
+        size_t count = spheres.size();
+        visible.resize(count);
+        size_t visibleCount = 0;
+#ifdef USE_SSE
+        if (useSimd)
+            visibleCount = testSpheresSse(spheres, count, visible.data());
+        else
+#endif
+        for (size_t i = 0; i < count; i++) {
+            visible[i] = testSphere(spheres.x[i], spheres.y[i], spheres.z[i], spheres.radius[i]);
+            visibleCount += visible[i];
+        }
+
+        stats.tested += count;
+        stats.visible += visibleCount;
+        return visibleCount;
+    }
+
+    /* Classifies a world space box, not counted in the stats */
+    Containment classifyBox(glm::vec3 boxMin, glm::vec3 boxMax) const {
+        Containment containment = INSIDE;
+        for (int p = 0; p < 6; p++) {
+            // Corners furthest along and against the plane normal
+            glm::vec3 front = glm::vec3(
+                planes[p].x >= 0.f ? boxMax.x : boxMin.x,
+                planes[p].y >= 0.f ? boxMax.y : boxMin.y,
+                planes[p].z >= 0.f ? boxMax.z : boxMin.z);
+            glm::vec3 back = boxMin + boxMax - front;
+            if (glm::dot(glm::vec3(planes[p]), front) + planes[p].w < 0.f)
+                return OUTSIDE;
+            if (glm::dot(glm::vec3(planes[p]), back) + planes[p].w < 0.f)
+                containment = INTERSECTING;
+        }
+        return containment;
+    }
+
+    /* Tests a world space box that passed its sphere test, one that turns out outside is counted as culled
+    *  @returns true if the box may be visible
+    */
+    bool refineBox(glm::vec3 boxMin, glm::vec3 boxMax) {
+        if (classifyBox(boxMin, boxMax) != OUTSIDE)
+            return true;
+        stats.visible--;
+        return false;
+    }
+
+    /* Getters */
+    Stats& getStats() {
+        return stats;
+    }
+};
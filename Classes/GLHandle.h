@@ -0,0 +1,120 @@
+#pragma once
+/* Owns one GL object name and deletes it when reset or destroyed
+*  Move-only, so owners can be returned and kept in vectors but never copied, and
+*  every name is deleted exactly once. Vertex arrays and textures are deleted
+*  through GLState, which forgets their bindings. Handles still owning a name
+*  must be reset while the context is current, destroying an empty one makes no
+*  GL call. GL thread only.
+*/
+template<typename Traits>
+class GLHandle {
+private:
+    GLuint name = 0;
+
+public:
+    GLHandle() {}
+
+    /* @param name - object name to take ownership of, 0 for none */
+    explicit GLHandle(GLuint name) : name(name) {}
+
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+
+    GLHandle(GLHandle&& other) noexcept : name(other.name) {
+        other.name = 0;
+    }
+
+    GLHandle& operator=(GLHandle&& other) noexcept {
+        if (this != &other) {
+            reset(other.name);
+            other.name = 0;
+        }
+        return *this;
+    }
+
+    ~GLHandle() {
+        reset();
+    }
+
+    /* Returns a handle owning a newly generated name */
+    static GLHandle generate() {
+        GLuint name = 0;
+        Traits::generate(name);
+        return GLHandle(name);
+    }
+
+    /* Deletes the owned name, then takes ownership of another
+    *  @param newName (optional) - object name to own afterwards, 0 for none
+    */
+    void reset(GLuint newName = 0) {
+        if (name != 0 && name != newName)
+            Traits::destroy(name);
+        name = newName;
+    }
+
+    /* Getters */
+    GLuint get() const {
+        return name;
+    }
+};
+
+struct GLBufferTraits {
+    static void generate(GLuint& name) {
+        glGenBuffers(1, &name);
+    }
+    static void destroy(GLuint name) {
+        glDeleteBuffers(1, &name);
+    }
+};
+
+struct GLVertexArrayTraits {
+    static void generate(GLuint& name) {
+        glGenVertexArrays(1, &name);
+    }
+    static void destroy(GLuint name) {
+        GLState::getCurrent().deleteVertexArrays(1, &name);
+    }
+};
+
+struct GLTextureTraits {
+    static void generate(GLuint& name) {
+        glGenTextures(1, &name);
+    }
+    static void destroy(GLuint name) {
+        GLState::getCurrent().deleteTextures(1, &name);
+    }
+};
+
+struct GLFramebufferTraits {
+    static void generate(GLuint& name) {
+        glGenFramebuffers(1, &name);
+    }
+    static void destroy(GLuint name) {
+        glDeleteFramebuffers(1, &name);
+    }
+};
+
+struct GLRenderbufferTraits {
+    static void generate(GLuint& name) {
+        glGenRenderbuffers(1, &name);
+    }
+    static void destroy(GLuint name) {
+        glDeleteRenderbuffers(1, &name);
+    }
+};
+
+struct GLQueryTraits {
+    static void generate(GLuint& name) {
+        glGenQueries(1, &name);
+    }
+    static void destroy(GLuint name) {
+        glDeleteQueries(1, &name);
+    }
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLRenderbufferTraits> GLRenderbuffer;
+typedef GLHandle<GLQueryTraits> GLQuery;
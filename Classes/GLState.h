@@ -0,0 +1,188 @@
+#pragma once
+/* Tracks GL binding state and skips calls that would not change it
+*  Covers the current program, vertex array, active texture unit, the 2D
+*  texture and cube map bound to each unit, depth mask and function, blending, and int
+*  uniforms such as sampler units per program. State starts unknown, so the
+*  first call of each kind always reaches the driver. Objects must be deleted
+*  through it, so a reused name is not mistaken for the one still bound.
+*  GL thread only.
+*/
+class GLState {
+public:
+    static const int MAX_UNITS = 16;
+
+    /* State calls made since the counts were last reset */
+    struct Counts {
+        size_t issued = 0;
+        size_t skipped = 0;
+    };
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLenum activeUnit;
+    // Bound 2D texture and cube map of each unit
+    GLuint textures[MAX_UNITS][2];
+    GLuint depthMask;
+    GLenum depthFunc;
+    GLuint blend;
+    // Int uniform values by program and location
+    std::unordered_map<uint64_t, GLint> intUniforms;
+    Counts counts;
+
+    /* Counts a call, returns true if it matches the current state */
+    bool isRedundant(bool matches) {
+        if (matches)
+            counts.skipped++;
+        else
+            counts.issued++;
+        return matches;
+    }
+
+    /* Returns slot of a texture target in the per-unit bindings, -1 if not tracked */
+    static int getTargetSlot(GLenum target) {
+        if (target == GL_TEXTURE_2D)
+            return 0;
+        if (target == GL_TEXTURE_CUBE_MAP)
+            return 1;
+        return -1;
+    }
+
+public:
+    GLState() {
+        invalidate();
+    }
+    GLState(const GLState&) = delete;
+    GLState& operator=(const GLState&) = delete;
+
+    /* Returns the state of the context current on the GL thread */
+    static GLState& getCurrent() {
+        static GLState state;
+        return state;
+    }
+
+    /* Forgets all tracked state, call after GL calls made around this class */
+    void invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (int unit = 0; unit < MAX_UNITS; unit++)
+            textures[unit][0] = textures[unit][1] = UNKNOWN;
+        depthMask = UNKNOWN;
+        depthFunc = UNKNOWN;
+        blend = UNKNOWN;
+        intUniforms.clear();
+    }
+
+    void useProgram(GLuint shaderProgram) {
+        if (isRedundant(program == shaderProgram))
+            return;
+        program = shaderProgram;
+        glUseProgram(shaderProgram);
+    }
+
+    void bindVertexArray(GLuint array) {
+        if (isRedundant(vertexArray == array))
+            return;
+        vertexArray = array;
+        glBindVertexArray(array);
+    }
+
+    /* @param unit - GL_TEXTURE0 and up */
+    void activeTexture(GLenum unit) {
+        if (isRedundant(activeUnit == unit))
+            return;
+        activeUnit = unit;
+        glActiveTexture(unit);
+    }
+
+    /* Binds a texture to a unit, the unit is active afterwards
+    *  @param unit - GL_TEXTURE0 and up
+    *  @param target - GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP, other targets are not tracked
+    *  @param texture - texture name
+    */
+    void bindTexture(GLenum unit, GLenum target, GLuint texture) {
+        activeTexture(unit);
+        int index = (int)(unit - GL_TEXTURE0);
+        int slot = getTargetSlot(target);
+        if (slot < 0 || index < 0 || index >= MAX_UNITS) {
+            counts.issued++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if (isRedundant(textures[index][slot] == texture))
+            return;
+        textures[index][slot] = texture;
+        glBindTexture(target, texture);
+    }
+
+    void setDepthMask(GLboolean mask) {
+        if (isRedundant(depthMask == mask))
+            return;
+        depthMask = mask;
+        glDepthMask(mask);
+    }
+
+    void setDepthFunc(GLenum func) {
+        if (isRedundant(depthFunc == func))
+            return;
+        depthFunc = func;
+        glDepthFunc(func);
+    }
+
+    /* Enables alpha blending over the target, or disables it */
+    void setBlend(bool enabled) {
+        if (isRedundant(blend == (GLuint)enabled))
+            return;
+        blend = enabled;
+        if (enabled) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        else
+            glDisable(GL_BLEND);
+    }
+
+    /* Sets an int uniform of the current program
+    *  @returns true if the value changed and was sent to the driver
+    */
+    bool setUniform(GLint location, GLint value) {
+        if (location < 0 || program == UNKNOWN) {
+            counts.issued++;
+            glUniform1i(location, value);
+            return true;
+        }
+        uint64_t key = (uint64_t)program << 32 | (uint32_t)location;
+        std::unordered_map<uint64_t, GLint>::iterator found = intUniforms.find(key);
+        if (isRedundant(found != intUniforms.end() && found->second == value))
+            return false;
+        intUniforms[key] = value;
+        glUniform1i(location, value);
+        return true;
+    }
+
+    /* Deletes textures and unbinds them from the tracked units */
+    void deleteTextures(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; i++)
+            for (int unit = 0; unit < MAX_UNITS; unit++)
+                for (int slot = 0; slot < 2; slot++)
+                    if (names[i] != 0 && textures[unit][slot] == names[i])
+                        textures[unit][slot] = 0;
+        glDeleteTextures(count, names);
+    }
+
+    /* Deletes vertex arrays and unbinds them if current */
+    void deleteVertexArrays(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; i++)
+            if (names[i] != 0 && vertexArray == names[i])
+                vertexArray = 0;
+        glDeleteVertexArrays(count, names);
+    }
+
+    /* Getters */
+    Counts& getCounts() {
+        return counts;
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+/* Decoded image pixels kept in memory until uploaded to a texture
+*  Safe to decode on worker threads, the flip setting is per thread.
+*  Images baked into the mounted asset pack are used from its mapping
+*  instead, together with their prebuilt mip levels.
+*/
+class Image {
+private:
+    std::shared_ptr<unsigned char> pixels;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    // Stored mip levels including the full size one, 1 if mipmaps are left to the GPU
+    int levels = 1;
+
+public:
+    Image() {}
+
+    /* Decodes image from path
+    *  @param path - image file
+    *  @param flip (optional) - flip rows so the first row is the bottom of the image
+    *  @returns true if the image was decoded
+    */
+    bool load(std::string path, bool flip = true) {
+        // Baked pixels, only if they were stored with the same row order
+        AssetPack::Asset asset;
+        if (AssetPack::getMounted().find(path, AssetPack::TEXTURE, asset) && (asset.entry->flipped != 0) == flip) {
+            width = (int)asset.entry->width;
+            height = (int)asset.entry->height;
+            channels = (int)asset.entry->layout;
+            levels = (int)asset.entry->levels;
+            if (levels >= 1 && asset.entry->dataSize >= getLevelOffset(width, height, channels, levels)) {
+                pixels = std::shared_ptr<unsigned char>(asset.mapping, (unsigned char*)asset.data);
+                return true;
+            }
+        }
+
+        levels = 1;
+        stbi_set_flip_vertically_on_load_thread(flip);
+        unsigned char* bytes = stbi_load(path.c_str(), &width, &height, &channels, 0);
+        if (!bytes)
+            return false;
+
+        pixels = std::shared_ptr<unsigned char>(bytes, stbi_image_free);
+        return true;
+    }
+
+    /* Returns byte offset of a mip level in a tightly packed chain
+    *  Each level halves the previous one, down to 1 pixel per axis.
+    */
+    static size_t getLevelOffset(int width, int height, int channels, int level) {
+        size_t offset = 0;
+        for (int i = 0; i < level; i++)
+            offset += (size_t)getLevelExtent(width, i) * getLevelExtent(height, i) * channels;
+        return offset;
+    }
+
+    /* Returns size of a mip level along one axis of the given size */
+    static int getLevelExtent(int size, int level) {
+        return std::max(size >> level, 1);
+    }
+
+    /* Appends a box filtered mip chain down to 1x1 after the decoded pixels
+    *  Does nothing if the image already holds its mip levels.
+    */
+    void buildMipChain() {
+        if (!pixels || levels > 1)
+            return;
+
+        int chainLevels = 1;
+        while (getLevelExtent(width, chainLevels - 1) > 1 || getLevelExtent(height, chainLevels - 1) > 1)
+            chainLevels++;
+        std::shared_ptr<unsigned char> chain(new unsigned char[getLevelOffset(width, height, channels, chainLevels)],
+            std::default_delete<unsigned char[]>());
+        memcpy(chain.get(), pixels.get(), (size_t)width * height * channels);
+
+        for (int level = 1; level < chainLevels; level++) {
+            const unsigned char* source = chain.get() + getLevelOffset(width, height, channels, level - 1);
+            unsigned char* target = chain.get() + getLevelOffset(width, height, channels, level);
+            int sourceWidth = getLevelExtent(width, level - 1), sourceHeight = getLevelExtent(height, level - 1);
+            int targetWidth = getLevelExtent(width, level), targetHeight = getLevelExtent(height, level);
+
+            // Average each 2x2 block, odd edges reuse their last row or column
+            for (int y = 0; y < targetHeight; y++)
+                for (int x = 0; x < targetWidth; x++)
+                    for (int c = 0; c < channels; c++) {
+                        int sum = 0;
+                        for (int dy = 0; dy < 2; dy++)
+                            for (int dx = 0; dx < 2; dx++) {
+                                int sx = std::min(x * 2 + dx, sourceWidth - 1);
+                                int sy = std::min(y * 2 + dy, sourceHeight - 1);
+                                sum += source[((size_t)sy * sourceWidth + sx) * channels + c];
+                            }
+                        target[((size_t)y * targetWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+                    }
+        }
+
+        pixels = chain;
+        levels = chainLevels;
+    }
+
+    /* Returns size of all stored levels in bytes */
+    size_t getSize() const {
+        return getLevelOffset(width, height, channels, levels);
+    }
+
+    /* Frees decoded pixels after upload */
+    void release() {
+        pixels.reset();
+    }
+
+    /* Getters */
+    bool isLoaded() const {
+        return pixels != nullptr;
+    }
+    const unsigned char* getPixels() const {
+        return pixels.get();
+    }
+    int getWidth() const {
+        return width;
+    }
+    int getHeight() const {
+        return height;
+    }
+    int getChannels() const {
+        return channels;
+    }
+    /* Returns the pixel format of the channels, gray and gray with alpha are read into red and green */
+    GLenum getFormat() const {
+        static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        return channels >= 1 && channels <= 4 ? formats[channels - 1] : GL_RGBA;
+    }
+    /* Returns the GL_TEXTURE_SWIZZLE_RGBA that samples gray images as gray, nullptr for color images */
+    const GLint* getSwizzle() const {
+        static const GLint gray[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+        static const GLint grayAlpha[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+        return channels == 1 ? gray : channels == 2 ? grayAlpha : nullptr;
+    }
+    int getLevels() const {
+        return levels;
+    }
+    const unsigned char* getLevelPixels(int level) const {
+        return pixels.get() + getLevelOffset(width, height, channels, level);
+    }
+};
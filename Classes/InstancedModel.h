@@ -0,0 +1,302 @@
+#pragma once
+/* Draws many copies of one model with one call per texture
+*  Shares the vertex and element buffers and the textures of a loaded Model and reads the transform
+*  tint and normal matrix of each copy from an instance buffer, whose attributes advance once per instance through
+*  glVertexAttribDivisor. Programs drawing it need INSTANCE_ATTRIBUTES defined. The model must stay
+*  loaded and in place while this is used. With a culler, or visibility flags from a scene hierarchy
+*  query, only the visible instances are uploaded and drawn, the buffer is refilled when that set changes.
+*/
+class InstancedModel {
+public:
+    // Attribute locations of the instance data, the transform takes four and the normal matrix three
+    static const GLuint TRANSFORM_ATTRIB = 7;
+    static const GLuint TINT_ATTRIB = 11;
+    static const GLuint NORMAL_MATRIX_ATTRIB = 12;
+
+    /* Per-instance data, interleaved in the instance buffer */
+    struct Instance {
+        glm::mat4 transform;
+        glm::vec4 tint;
+        glm::mat3 normalMatrix;
+    };
+
+private:
+    Model* model = nullptr;
+    std::vector<Instance> instances;
+    int lodLevel = 0;
+    // Instances changed since the last upload, the last sphere rebuild and the last normal matrix rebuild
+    bool dirty = false;
+    bool spheresDirty = false;
+    bool normalsDirty = false;
+
+    // World bounding spheres of the instances, rebuilt when they change
+    FrustumCuller::SphereSet spheres;
+    // Visibility of this frame and of the instances in the buffer, empty if all were uploaded
+    std::vector<unsigned char> visible, uploadedVisible;
+    std::vector<Instance> visibleInstances;
+    size_t uploadedCount = 0;
+    size_t drawnCount = 0;
+
+    // Draw attributes
+    GLVertexArray VAO;
+    GLBuffer instanceVBO;
+    // Upload of the model buffers the vertex array records
+    int modelUpload = -1;
+
+    /* Rebuilds the bounding spheres from the model sphere and the instance transforms, scale is uniform */
+    void updateSpheres() {
+        glm::vec4 sphere = model->getBoundingSphere();
+        spheres.clear();
+        for (const Instance& instance : instances) {
+            glm::vec3 center = glm::vec3(instance.transform * glm::vec4(glm::vec3(sphere), 1.f));
+            spheres.add(glm::vec4(center, sphere.w * glm::length(glm::vec3(instance.transform[0]))));
+        }
+        spheresDirty = false;
+    }
+
+    /* Returns true if a transform scales every axis alike and does not shear */
+    static bool hasUniformScale(const glm::mat4& transform) {
+        glm::vec3 x = glm::vec3(transform[0]), y = glm::vec3(transform[1]), z = glm::vec3(transform[2]);
+        float lengthSquared = glm::dot(x, x);
+        float tolerance = lengthSquared * 1e-5f;
+        return std::abs(glm::dot(y, y) - lengthSquared) <= tolerance && std::abs(glm::dot(z, z) - lengthSquared) <= tolerance &&
+            std::abs(glm::dot(x, y)) <= tolerance && std::abs(glm::dot(y, z)) <= tolerance &&
+            std::abs(glm::dot(z, x)) <= tolerance;
+    }
+
+    /* Rebuilds the normal matrices of edited instances, once per instance rather than per vertex */
+    void updateNormalMatrices() {
+        for (Instance& instance : instances)
+            instance.normalMatrix = Model::computeNormalMatrix(instance.transform, hasUniformScale(instance.transform));
+        normalsDirty = false;
+    }
+
+    /* Replaces the buffer contents, orphaning the previous ones */
+    void upload(const std::vector<Instance>& uploaded) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO.get());
+        glBufferData(GL_ARRAY_BUFFER, uploaded.size() * sizeof(Instance), uploaded.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        uploadedCount = uploaded.size();
+        dirty = false;
+    }
+
+    /* Uploads the flagged instances unless they are already in the buffer */
+    void uploadVisible(const unsigned char* flags) {
+        size_t count = instances.size();
+        if (!dirty && uploadedVisible.size() == count && std::equal(flags, flags + count, uploadedVisible.begin()))
+            return;
+        visibleInstances.clear();
+        for (size_t i = 0; i < count; i++)
+            if (flags[i])
+                visibleInstances.push_back(instances[i]);
+        upload(visibleInstances);
+        uploadedVisible.assign(flags, flags + count);
+    }
+
+    /* Keeps the model uploaded while instances of it are drawn, rebuilding the vertex array after an eviction
+    *  @returns false while an evicted model is still loading
+    */
+    bool prepareModel() {
+        if (!model->makeResident())
+            return false;
+        if (model->getUploadCount() != modelUpload)
+            buildVertexArray();
+        return true;
+    }
+
+    /* Creates the vertex array over the current model buffers and the instance buffer */
+    void buildVertexArray() {
+        VAO = GLVertexArray::generate();
+        GLState::getCurrent().bindVertexArray(VAO.get());
+        model->setAttribPointers();
+
+        // One mat4 is four vec4 attributes
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO.get());
+        for (GLuint column = 0; column < 4; column++) {
+            glVertexAttribPointer(
+                TRANSFORM_ATTRIB + column,
+                4,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(Instance),
+                (void*)(column * sizeof(glm::vec4))
+            );
+            glEnableVertexAttribArray(TRANSFORM_ATTRIB + column);
+            glVertexAttribDivisor(TRANSFORM_ATTRIB + column, 1);
+        }
+        glVertexAttribPointer(
+            TINT_ATTRIB,
+            4,
+            GL_FLOAT,
+            GL_FALSE,
+            sizeof(Instance),
+            (void*)offsetof(Instance, tint)
+        );
+        glEnableVertexAttribArray(TINT_ATTRIB);
+        glVertexAttribDivisor(TINT_ATTRIB, 1);
+
+        // One mat3 is three vec3 attributes
+        for (GLuint column = 0; column < 3; column++) {
+            glVertexAttribPointer(
+                NORMAL_MATRIX_ATTRIB + column,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(Instance),
+                (void*)(offsetof(Instance, normalMatrix) + column * sizeof(glm::vec3))
+            );
+            glEnableVertexAttribArray(NORMAL_MATRIX_ATTRIB + column);
+            glVertexAttribDivisor(NORMAL_MATRIX_ATTRIB + column, 1);
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState::getCurrent().bindVertexArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        modelUpload = model->getUploadCount();
+    }
+
+    /* Draws the instances in the buffer */
+    void drawUploaded(GLint tex0) {
+        if (uploadedCount == 0)
+            return;
+        GLState& state = GLState::getCurrent();
+        state.bindVertexArray(VAO.get());
+        if (state.setUniform(tex0, 0))
+            ShaderManager::getCallCounts().uploads++;
+        model->drawSubmeshes((GLsizei)uploadedCount, lodLevel);
+        drawnCount = uploadedCount;
+    }
+
+public:
+    InstancedModel() {}
+    // Owns its vertex array and instance buffer, so it is moved but never copied
+    InstancedModel(const InstancedModel&) = delete;
+    InstancedModel& operator=(const InstancedModel&) = delete;
+    InstancedModel(InstancedModel&&) = default;
+    InstancedModel& operator=(InstancedModel&&) = default;
+
+    /* @param model - loaded model whose mesh and textures every instance shares */
+    InstancedModel(Model& model) {
+        this->model = &model;
+    }
+
+    /* Returns an instance transform, built in the order Model uses for object pivots
+    *  @param position - world position
+    *  @param rotation - degrees around the Y, X and Z axes
+    *  @param scale - uniform scale
+    */
+    static glm::mat4 makeTransform(glm::vec3 position, glm::vec3 rotation, float scale) {
+        glm::mat4 transform = glm::translate(glm::mat4(1.f), position);
+        transform = glm::rotate(transform, glm::radians(rotation[0]), glm::vec3(0.f, 1.f, 0.f));
+        transform = glm::rotate(transform, glm::radians(rotation[1]), glm::vec3(1.f, 0.f, 0.f));
+        transform = glm::rotate(transform, glm::radians(rotation[2]), glm::vec3(0.f, 0.f, 1.f));
+        return glm::scale(transform, glm::vec3(scale));
+    }
+
+    /* Adds an instance, uploaded before the next draw
+    *  @param tint (optional) - color multiplied with the lit texture
+    */
+    void add(glm::vec3 position, glm::vec3 rotation, float scale, glm::vec4 tint = glm::vec4(1.f)) {
+        Instance instance;
+        instance.transform = makeTransform(position, rotation, scale);
+        instance.tint = tint;
+        instance.normalMatrix = Model::computeNormalMatrix(instance.transform, true);
+        instances.push_back(instance);
+        dirty = spheresDirty = true;
+    }
+
+    /* Returns the instances for editing, they are uploaded again before the next draw */
+    std::vector<Instance>& editInstances() {
+        dirty = spheresDirty = normalsDirty = true;
+        return instances;
+    }
+
+    /* Creates a vertex array over the model buffers and the instance buffer */
+    void initBuffers() {
+        instanceVBO = GLBuffer::generate();
+        buildVertexArray();
+        dirty = true;
+    }
+
+    /* Draws the instances, the program must be in use
+    *  @param tex0 - uniform index to assign texture
+    *  @param culler (optional) - frustum to skip instances outside of, all are drawn without one
+    */
+    void draw(GLint tex0, FrustumCuller* culler = nullptr) {
+        drawnCount = 0;
+        if (instances.empty())
+            return;
+        if (normalsDirty)
+            updateNormalMatrices();
+        if (!prepareModel())
+            return;
+
+        if (culler) {
+            if (spheresDirty)
+                updateSpheres();
+            culler->cullSpheres(spheres, visible);
+            uploadVisible(visible.data());
+        }
+        else if (dirty || !uploadedVisible.empty()) {
+            upload(instances);
+            uploadedVisible.clear();
+        }
+        drawUploaded(tex0);
+    }
+
+    /* Draws the instances flagged visible, the program must be in use
+    *  @param tex0 - uniform index to assign texture
+    *  @param visibleFlags - one flag per instance, in the order they were added
+    */
+    void draw(GLint tex0, const unsigned char* visibleFlags) {
+        drawnCount = 0;
+        if (instances.empty())
+            return;
+        if (normalsDirty)
+            updateNormalMatrices();
+        if (!prepareModel())
+            return;
+        uploadVisible(visibleFlags);
+        drawUploaded(tex0);
+    }
+
+    /* Adds the world box of every instance to a scene hierarchy
+    *  @returns object id of the first instance, the others follow in order
+    */
+    int attachBvh(SceneBVH& bvh) {
+        int first = (int)bvh.getObjectCount();
+        for (const Instance& instance : instances) {
+            glm::vec3 worldMin, worldMax;
+            SceneBVH::transformBox(instance.transform, model->getBoundsMin(), model->getBoundsMax(), worldMin, worldMax);
+            bvh.insert(worldMin, worldMax);
+        }
+        return first;
+    }
+
+    /* Deletion of buffers after use, the model keeps its own */
+    void cleanup() {
+        VAO.reset();
+        instanceVBO.reset();
+    }
+
+    /* Getters */
+    size_t getInstanceCount() {
+        return instances.size();
+    }
+    // Instances of the last draw that passed culling
+    size_t getDrawnCount() {
+        return drawnCount;
+    }
+    size_t getTriangleCount() {
+        return model->getTriangleCount(lodLevel) * instances.size();
+    }
+    int getDrawCalls() {
+        return drawnCount > 0 ? model->getDrawCalls() : 0;
+    }
+
+    /* Setters */
+    /* @param level - level of detail of every instance, clamped to the levels the model has */
+    void setLodLevel(int level) {
+        lodLevel = std::max(0, std::min(level, model->getLodCount() - 1));
+    }
+};
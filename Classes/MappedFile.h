@@ -0,0 +1,105 @@
+#pragma once
+/* Read-only memory mapping of a whole file
+*  Mappings cannot be copied, share them through std::shared_ptr
+*  when more than one object needs the mapped data.
+*/
+class MappedFile {
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        unmap();
+    }
+
+    /* Maps file at path into memory
+    *  @param path - file to map
+    *  @returns true if the file was mapped
+    */
+    bool map(std::string path) {
+        unmap();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            unmap();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            unmap();
+            return false;
+        }
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(file, &st) != 0 || st.st_size == 0) {
+            unmap();
+            return false;
+        }
+        size = (size_t)st.st_size;
+
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        data = view == MAP_FAILED ? nullptr : (const unsigned char*)view;
+#endif
+        if (data == nullptr) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    /* Releases mapping and file handles */
+    void unmap() {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void*)data, size);
+        if (file >= 0)
+            close(file);
+        file = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    /* Getters */
+    bool isMapped() {
+        return data != nullptr;
+    }
+    const unsigned char* getData() {
+        return data;
+    }
+    size_t getSize() {
+        return size;
+    }
+};
\ No newline at end of file
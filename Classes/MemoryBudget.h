@@ -0,0 +1,204 @@
+#pragma once
+/* Accounts the CPU and GPU bytes of loaded assets and evicts the least recently drawn ones over budget
+*  Owners track each asset under a category, report its sizes when they change and mark it drawn in
+*  every frame that uses it. When the GPU total passes the budget at the end of a frame, assets not
+*  drawn in that frame are flagged, oldest draw first, until the others fit. Owners free the GPU copy
+*  of flagged assets and upload it again the next time they draw them. Assets are referred to by id,
+*  so owners can be moved. GL thread only.
+*/
+class MemoryBudget {
+public:
+    enum Category { MESHES, TEXTURES, CUBEMAPS, CATEGORY_COUNT };
+
+    /* Bytes held in memory and in GL objects */
+    struct Usage {
+        size_t cpuBytes = 0;
+        size_t gpuBytes = 0;
+    };
+
+    /* Evictions and uploads again since the stats were last reset */
+    struct Stats {
+        size_t evictions = 0;
+        size_t evictedBytes = 0;
+        size_t restores = 0;
+    };
+
+private:
+    struct Asset {
+        std::string name;
+        Category category = MESHES;
+        Usage usage;
+        bool evictable = true;
+        // Picked for eviction, cleared once the owner draws or uploads it again
+        bool flagged = false;
+        bool tracked = false;
+        uint64_t lastDrawn = 0;
+    };
+
+    std::vector<Asset> assets;
+    std::vector<int> freeIds;
+    // Ids of the eviction candidates, kept between frames
+    std::vector<int> candidates;
+    size_t gpuBudget = 0;
+    uint64_t frame = 1;
+    Stats stats;
+
+    MemoryBudget() {}
+
+public:
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    /* Returns the budget shared by every asset */
+    static MemoryBudget& get() {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    /* Returns name of a category for printing */
+    static const char* getCategoryName(Category category) {
+        static const char* names[CATEGORY_COUNT] = { "meshes", "textures", "cubemaps" };
+        return names[category];
+    }
+
+    /* Starts accounting an asset, counted as drawn in the current frame
+    *  @param name - file the asset was loaded from, for printing
+    *  @param category - kind of asset
+    *  @param evictable (optional) - false for assets drawn every frame, they are never flagged
+    *  @returns id to report the asset by
+    */
+    int track(std::string name, Category category, bool evictable = true) {
+        int id;
+        if (freeIds.empty()) {
+            id = (int)assets.size();
+            assets.push_back(Asset());
+        }
+        else {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        Asset& asset = assets[id];
+        asset = Asset();
+        asset.name = name;
+        asset.category = category;
+        asset.evictable = evictable;
+        asset.tracked = true;
+        asset.lastDrawn = frame;
+        return id;
+    }
+
+    /* Stops accounting an asset whose owner freed it, its id may be reused */
+    void untrack(int id) {
+        if (id < 0 || !assets[id].tracked)
+            return;
+        assets[id] = Asset();
+        freeIds.push_back(id);
+    }
+
+    /* Sets the bytes an asset holds */
+    void setUsage(int id, size_t cpuBytes, size_t gpuBytes) {
+        assets[id].usage.cpuBytes = cpuBytes;
+        assets[id].usage.gpuBytes = gpuBytes;
+    }
+
+    /* Records that an asset is drawn in the current frame, a flag its owner has not acted on is dropped */
+    void markDrawn(int id) {
+        assets[id].lastDrawn = frame;
+        assets[id].flagged = false;
+    }
+
+    /* Returns true if an asset was picked for eviction, its owner should free its GPU copy */
+    bool isFlagged(int id) {
+        return assets[id].flagged;
+    }
+
+    /* Records that the owner of a flagged asset freed its GPU copy */
+    void release(int id) {
+        stats.evictions++;
+        stats.evictedBytes += assets[id].usage.gpuBytes;
+        assets[id].usage.gpuBytes = 0;
+    }
+
+    /* Records that the owner of a flagged asset drew it again, uploading the GPU copy if it was freed
+    *  @param gpuBytes - GPU bytes the asset holds again
+    */
+    void restore(int id, size_t gpuBytes) {
+        Asset& asset = assets[id];
+        if (asset.usage.gpuBytes == 0 && gpuBytes > 0)
+            stats.restores++;
+        asset.usage.gpuBytes = gpuBytes;
+        asset.flagged = false;
+        asset.lastDrawn = frame;
+    }
+
+    /* Flags the least recently drawn assets while the GPU total is over budget, then starts the next frame */
+    void endFrame() {
+        size_t total = 0;
+        for (const Asset& asset : assets)
+            if (asset.tracked && !asset.flagged)
+                total += asset.usage.gpuBytes;
+
+        if (gpuBudget > 0 && total > gpuBudget) {
+            candidates.clear();
+            for (int id = 0; id < (int)assets.size(); id++) {
+                const Asset& asset = assets[id];
+                if (asset.tracked && asset.evictable && !asset.flagged && asset.lastDrawn < frame &&
+                    asset.usage.gpuBytes > 0)
+                    candidates.push_back(id);
+            }
+            std::sort(candidates.begin(), candidates.end(), [this](int a, int b) {
+                return assets[a].lastDrawn < assets[b].lastDrawn;
+            });
+            for (size_t i = 0; i < candidates.size() && total > gpuBudget; i++) {
+                assets[candidates[i]].flagged = true;
+                total -= assets[candidates[i]].usage.gpuBytes;
+            }
+        }
+        frame++;
+    }
+
+    /* Prints the bytes of every asset, then the totals of each category */
+    void printAssets() {
+        for (int category = 0; category < CATEGORY_COUNT; category++) {
+            Usage usage = getUsage((Category)category);
+            std::cout << "  " << getCategoryName((Category)category) << ": " << usage.cpuBytes / 1024 << " KB CPU, "
+                << usage.gpuBytes / 1024 << " KB GPU" << std::endl;
+            for (const Asset& asset : assets)
+                if (asset.tracked && asset.category == category)
+                    std::cout << "    " << asset.name << ": " << asset.usage.cpuBytes / 1024 << " KB CPU, "
+                        << asset.usage.gpuBytes / 1024 << " KB GPU" << std::endl;
+        }
+    }
+
+    /* Getters */
+    Usage getUsage(Category category) {
+        Usage usage;
+        for (const Asset& asset : assets)
+            if (asset.tracked && asset.category == category) {
+                usage.cpuBytes += asset.usage.cpuBytes;
+                usage.gpuBytes += asset.usage.gpuBytes;
+            }
+        return usage;
+    }
+    Usage getTotal() {
+        Usage total;
+        for (int category = 0; category < CATEGORY_COUNT; category++) {
+            Usage usage = getUsage((Category)category);
+            total.cpuBytes += usage.cpuBytes;
+            total.gpuBytes += usage.gpuBytes;
+        }
+        return total;
+    }
+    size_t getBudget() {
+        return gpuBudget;
+    }
+    Stats& getStats() {
+        return stats;
+    }
+
+    /* Setters */
+    /* @param bytes - GPU bytes the assets may hold before the least recently drawn are evicted, 0 for no limit */
+    void setBudget(size_t bytes) {
+        gpuBudget = bytes;
+    }
+};
@@ -0,0 +1,289 @@
+#pragma once
+/* Binary image of a model's processed vertex and index data
+*  Images are saved next to the source OBJ as "<objPath>.meshcache" and are
+*  memory-mapped on later launches so that the buffers can be uploaded
+*  without parsing the OBJ again. An image is only used if the source file
+*  has the same size and modification time, and the vertex layout matches.
+*  The packer embeds the same images in the asset pack.
+*/
+class MeshCache {
+public:
+    // Largest number of levels of detail an image can hold
+    static const int MAX_LODS = 4;
+
+private:
+    // Bump when the layout or the generated contents of the image change
+    static const uint32_t VERSION = 6;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t offset;        // Floats per vertex
+        uint32_t indexSize;     // Bytes per index, 2 or 4
+        uint32_t flags;         // Processing options the image was built with
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t sourceVertexCount;
+        uint64_t dataStart;     // Byte offset of vertex data from start of image
+        uint64_t indexStart;    // Byte offset of index data from start of image
+        // Vertex cache efficiency before and after optimization
+        float acmrBefore, atvrBefore;
+        float acmrAfter, atvrAfter;
+        // Bounding box of the vertex positions
+        float boundsMin[3], boundsMax[3];
+        // Index ranges of the levels of detail, the first is the full mesh
+        uint32_t lodCount;
+        uint32_t submeshCount;  // Submeshes per level of detail
+        MeshSimplifier::Lod lods[MAX_LODS];
+        uint64_t submeshStart;  // Byte offset of submesh table, lodCount * submeshCount entries
+        uint64_t pathStart;     // Byte offset of material texture paths, each ends with '\0'
+        uint64_t pathSize;
+    };
+
+    // Alignment of data blocks for direct use from the mapping
+    static const uint64_t ALIGNMENT = 64;
+
+    static uint64_t align(uint64_t value) {
+        return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+public:
+    /* Index range of one level of detail drawn with one texture */
+    struct Submesh {
+        uint32_t indexOffset = 0;
+        uint32_t indexCount = 0;
+        // First OBJ material of the range, -1 if it has none
+        int32_t material = -1;
+        // Texture slot, 0 is the texture of the model and 1 and up are material textures
+        int32_t texture = 0;
+    };
+
+    /* Processed mesh data, read from or written to an image */
+    struct Mesh {
+        const GLfloat* vertices = nullptr;
+        size_t vertexCount = 0;
+        const void* indices = nullptr;
+        size_t indexCount = 0;
+        int indexSize = 4;
+        // Vertex count of the fully expanded mesh before welding
+        size_t sourceVertexCount = 0;
+        // Processing options, images built with other options are rejected
+        uint32_t flags = 0;
+        MeshOptimizer::Stats cacheBefore, cacheAfter;
+        glm::vec3 boundsMin = glm::vec3(0), boundsMax = glm::vec3(0);
+        std::vector<MeshSimplifier::Lod> lods;
+        std::vector<Submesh> submeshes;
+        std::vector<std::string> texturePaths;
+    };
+
+    // Processing flags
+    static const uint32_t OPTIMIZED_OVERDRAW = 1;
+    static const uint32_t GENERATED_LODS = 2;
+
+    static std::string getCachePath(std::string objPath) {
+        return objPath + ".meshcache";
+    }
+
+    /* Maps a cached image of the given model if it is still valid
+    *  @param objPath - source OBJ of the model
+    *  @param offset - floats per vertex expected by the model
+    *  @param mesh - flags must be set to the expected processing options,
+    *       receives the mapped mesh data
+    *  @returns mapping that owns the mesh data, or nullptr if there is no valid image
+    */
+    static std::shared_ptr<MappedFile> load(std::string objPath, int offset, Mesh& mesh) {
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!statSource(objPath, sourceSize, sourceTime))
+            return nullptr;
+
+        std::shared_ptr<MappedFile> image = std::make_shared<MappedFile>();
+        if (!image->map(getCachePath(objPath)) || image->getSize() < sizeof(Header))
+            return nullptr;
+
+        // Reject images written for another version of the source
+        const Header* header = (const Header*)image->getData();
+        if (header->sourceSize != sourceSize || header->sourceTime != sourceTime)
+            return nullptr;
+        if (!parse(image->getData(), image->getSize(), offset, mesh))
+            return nullptr;
+        return image;
+    }
+
+    /* Reads an image from memory, such as a mapped cache file or asset pack entry
+    *  The image must start at a 64-byte aligned address and stay alive while mesh is used.
+    *  @param data - start of the image
+    *  @param size - size of the image in bytes
+    *  @param offset - floats per vertex expected by the model
+    *  @param mesh - flags must be set to the expected processing options,
+    *       receives pointers into the image
+    *  @returns true if the image is valid for this layout and these options
+    */
+    static bool parse(const unsigned char* data, size_t size, int offset, Mesh& mesh) {
+        if (size < sizeof(Header))
+            return false;
+
+        // Reject images written for another version or vertex layout
+        const Header* header = (const Header*)data;
+        if (memcmp(header->magic, "MCOM", 4) != 0 ||
+            header->version != VERSION ||
+            header->offset != (uint32_t)offset ||
+            header->flags != mesh.flags ||
+            (header->indexSize != 2 && header->indexSize != 4))
+            return false;
+
+        uint64_t dataSize = header->vertexCount * header->offset * sizeof(GLfloat);
+        uint64_t indexBytes = header->indexCount * header->indexSize;
+        if (header->dataStart < sizeof(Header) || header->dataStart + dataSize > size ||
+            header->indexStart < header->dataStart + dataSize || header->indexStart + indexBytes > size)
+            return false;
+        if (header->lodCount < 1 || header->lodCount > MAX_LODS)
+            return false;
+        for (uint32_t i = 0; i < header->lodCount; i++)
+            if ((uint64_t)header->lods[i].indexOffset + header->lods[i].indexCount > header->indexCount)
+                return false;
+
+        uint64_t submeshBytes = (uint64_t)header->lodCount * header->submeshCount * sizeof(Submesh);
+        if (header->submeshCount == 0 ||
+            header->submeshStart < header->indexStart + indexBytes || header->submeshStart + submeshBytes > size ||
+            header->pathStart < header->submeshStart + submeshBytes || header->pathStart + header->pathSize > size)
+            return false;
+        const Submesh* submeshes = (const Submesh*)(data + header->submeshStart);
+        for (uint64_t i = 0; i < (uint64_t)header->lodCount * header->submeshCount; i++)
+            if ((uint64_t)submeshes[i].indexOffset + submeshes[i].indexCount > header->indexCount)
+                return false;
+
+        mesh.vertices = (const GLfloat*)(data + header->dataStart);
+        mesh.vertexCount = (size_t)header->vertexCount;
+        mesh.indices = data + header->indexStart;
+        mesh.indexCount = (size_t)header->indexCount;
+        mesh.indexSize = (int)header->indexSize;
+        mesh.sourceVertexCount = (size_t)header->sourceVertexCount;
+        mesh.cacheBefore.acmr = header->acmrBefore;
+        mesh.cacheBefore.atvr = header->atvrBefore;
+        mesh.cacheAfter.acmr = header->acmrAfter;
+        mesh.cacheAfter.atvr = header->atvrAfter;
+        mesh.boundsMin = glm::make_vec3(header->boundsMin);
+        mesh.boundsMax = glm::make_vec3(header->boundsMax);
+        mesh.lods.assign(header->lods, header->lods + header->lodCount);
+        mesh.submeshes.assign(submeshes, submeshes + (size_t)header->lodCount * header->submeshCount);
+
+        // Split the path block at each terminator
+        const char* paths = (const char*)(data + header->pathStart);
+        mesh.texturePaths.clear();
+        for (uint64_t start = 0, i = 0; i < header->pathSize; i++)
+            if (paths[i] == '\0') {
+                mesh.texturePaths.push_back(std::string(paths + start, paths + i));
+                start = i + 1;
+            }
+        return true;
+    }
+
+    /* Writes an image of processed mesh data next to its source OBJ
+    *  @param objPath - source OBJ of the model
+    *  @param offset - floats per vertex
+    *  @param mesh - interleaved vertex data and indices
+    *  @returns true if the image was written
+    */
+    static bool save(std::string objPath, int offset, const Mesh& mesh) {
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!statSource(objPath, sourceSize, sourceTime))
+            return false;
+
+        // Write to a temporary file first so a partial image is never mapped
+        std::string path = getCachePath(objPath);
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out || !write(out, offset, mesh, sourceSize, sourceTime)) {
+                out.close();
+                std::remove(tempPath.c_str());
+                return false;
+            }
+        }
+
+        std::remove(path.c_str());
+        return std::rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+
+    /* Writes an image of processed mesh data to a stream
+    *  Blocks are aligned relative to the start of the image, so it must be
+    *  written at a 64-byte aligned position to be used from a mapping.
+    *  @param out - binary stream
+    *  @param offset - floats per vertex
+    *  @param mesh - interleaved vertex data and indices
+    *  @param sourceSize - size of the source OBJ, checked by load()
+    *  @param sourceTime - modification time of the source OBJ, checked by load()
+    *  @returns true if the image was written
+    */
+    static bool write(std::ostream& out, int offset, const Mesh& mesh, uint64_t sourceSize, int64_t sourceTime) {
+        Header header = {};
+        memcpy(header.magic, "MCOM", 4);
+        header.version = VERSION;
+        header.offset = offset;
+        header.indexSize = mesh.indexSize;
+        header.vertexCount = mesh.vertexCount;
+        header.indexCount = mesh.indexCount;
+        header.sourceVertexCount = mesh.sourceVertexCount;
+        header.flags = mesh.flags;
+        header.sourceSize = sourceSize;
+        header.sourceTime = sourceTime;
+        header.acmrBefore = mesh.cacheBefore.acmr;
+        header.atvrBefore = mesh.cacheBefore.atvr;
+        header.acmrAfter = mesh.cacheAfter.acmr;
+        header.atvrAfter = mesh.cacheAfter.atvr;
+        memcpy(header.boundsMin, glm::value_ptr(mesh.boundsMin), sizeof(header.boundsMin));
+        memcpy(header.boundsMax, glm::value_ptr(mesh.boundsMax), sizeof(header.boundsMax));
+        if (mesh.lods.empty() || mesh.lods.size() > MAX_LODS)
+            return false;
+        header.lodCount = (uint32_t)mesh.lods.size();
+        std::copy(mesh.lods.begin(), mesh.lods.end(), header.lods);
+        if (mesh.submeshes.empty() || mesh.submeshes.size() % mesh.lods.size() != 0)
+            return false;
+        header.submeshCount = (uint32_t)(mesh.submeshes.size() / mesh.lods.size());
+
+        header.dataStart = align(sizeof(Header));
+        uint64_t dataSize = mesh.vertexCount * offset * sizeof(GLfloat);
+        header.indexStart = align(header.dataStart + dataSize);
+        uint64_t indexBytes = (uint64_t)mesh.indexCount * mesh.indexSize;
+        header.submeshStart = align(header.indexStart + indexBytes);
+
+        // Texture paths follow the submesh table, each ends with '\0'
+        std::string paths;
+        for (const std::string& path : mesh.texturePaths)
+            paths += path + '\0';
+        header.pathStart = header.submeshStart + mesh.submeshes.size() * sizeof(Submesh);
+        header.pathSize = paths.size();
+
+        char padding[ALIGNMENT] = {};
+        out.write((const char*)&header, sizeof(Header));
+        out.write(padding, header.dataStart - sizeof(Header));
+        out.write((const char*)mesh.vertices, dataSize);
+        out.write(padding, header.indexStart - header.dataStart - dataSize);
+        out.write((const char*)mesh.indices, indexBytes);
+        out.write(padding, header.submeshStart - header.indexStart - indexBytes);
+        out.write((const char*)mesh.submeshes.data(), mesh.submeshes.size() * sizeof(Submesh));
+        out.write(paths.data(), paths.size());
+        return (bool)out;
+    }
+
+    /* Reads size and last modification time of a file */
+    static bool statSource(std::string path, uint64_t& size, int64_t& time) {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0)
+            return false;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+#endif
+        size = (uint64_t)st.st_size;
+        time = (int64_t)st.st_mtime;
+        return true;
+    }
+};
\ No newline at end of file
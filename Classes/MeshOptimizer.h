@@ -0,0 +1,252 @@
+#pragma once
+/* Reorders indexed triangle meshes for the GPU
+*  Triangles are ordered for the post-transform vertex cache with Tipsify
+*  (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+*  Overdraw"), the clusters it produces can be sorted so that outward facing
+*  parts are drawn first, and vertices are then reordered by first use so
+*  that vertex fetch walks the buffer linearly.
+*/
+class MeshOptimizer {
+public:
+    // FIFO cache size that orderings are optimized for and measured with
+    static const int CACHE_SIZE = 16;
+
+    /* Vertex cache efficiency of an index buffer */
+    struct Stats {
+        // Average cache miss ratio, transformed vertices per triangle (0.5 - 3)
+        float acmr = 0;
+        // Average transform to vertex ratio, transformed vertices per unique vertex (1 - 6)
+        float atvr = 0;
+    };
+
+    /* Simulates a FIFO post-transform cache over a triangle list
+    *  @param indices - triangle list
+    *  @param vertexCount - number of vertices addressed by indices
+    *  @param cacheSize (optional) - number of cached vertices
+    *  @returns ACMR and ATVR of the ordering
+    */
+    static Stats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize = CACHE_SIZE) {
+        Stats stats;
+        if (indices.empty())
+            return stats;
+
+        // A vertex is cached if it entered the FIFO less than cacheSize misses ago
+        std::vector<size_t> cachedAt(vertexCount, 0);
+        std::vector<bool> used(vertexCount, false);
+        size_t misses = 0, usedCount = 0;
+        for (GLuint index : indices) {
+            if (!used[index]) {
+                used[index] = true;
+                usedCount++;
+            }
+            if (cachedAt[index] == 0 || misses - cachedAt[index] >= (size_t)cacheSize) {
+                misses++;
+                cachedAt[index] = misses;
+            }
+        }
+
+        stats.acmr = (float)misses / (indices.size() / 3);
+        stats.atvr = (float)misses / usedCount;
+        return stats;
+    }
+
+    /* Reorders triangles for the post-transform vertex cache with Tipsify
+    *  @param indices - triangle list, reordered in place
+    *  @param vertexCount - number of vertices addressed by indices
+    *  @param clusters (optional) - receives the first triangle of every cluster,
+    *       clusters start wherever the ordering had to jump to a new area
+    *  @param cacheSize (optional) - cache size to optimize for
+    */
+    static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount,
+        std::vector<size_t>* clusters = nullptr, int cacheSize = CACHE_SIZE)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (clusters)
+            clusters->clear();
+        if (triangleCount == 0)
+            return;
+
+        // Triangles using each vertex, stored as offsets into one array
+        std::vector<size_t> adjacencyStart(vertexCount + 1, 0);
+        for (GLuint index : indices)
+            adjacencyStart[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyStart[v + 1] += adjacencyStart[v];
+        std::vector<GLuint> adjacency(indices.size());
+        std::vector<size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = (GLuint)(i / 3);
+
+        // Live triangles per vertex, cache time stamps and dead-end stack
+        std::vector<int> live(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            live[v] = (int)(adjacencyStart[v + 1] - adjacencyStart[v]);
+        std::vector<int> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<GLuint> deadEnd;
+        std::vector<GLuint> candidates;
+
+        std::vector<GLuint> output;
+        output.reserve(indices.size());
+        int time = cacheSize + 1;
+        size_t cursor = 0;
+        long long fanning = indices[0];
+        bool jumped = true;
+
+        while (fanning >= 0) {
+            if (jumped && clusters)
+                clusters->push_back(output.size() / 3);
+            jumped = false;
+
+            // Emit every remaining triangle around the fanning vertex
+            candidates.clear();
+            for (size_t a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++) {
+                GLuint triangle = adjacency[a];
+                if (emitted[triangle])
+                    continue;
+
+                for (int corner = 0; corner < 3; corner++) {
+                    GLuint v = indices[triangle * 3 + corner];
+                    output.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cacheTime[v] > cacheSize)
+                        cacheTime[v] = time++;
+                }
+                emitted[triangle] = true;
+            }
+
+            // Pick the candidate that is in the cache longest and will still be after fanning
+            long long next = -1;
+            int best = -1;
+            for (GLuint v : candidates) {
+                if (live[v] <= 0)
+                    continue;
+                int priority = 0;
+                if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                    priority = time - cacheTime[v];
+                if (priority > best) {
+                    best = priority;
+                    next = v;
+                }
+            }
+
+            // Dead end, resume from a recently used vertex or the next unused one
+            if (next < 0) {
+                jumped = true;
+                while (!deadEnd.empty()) {
+                    GLuint v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (live[v] > 0) {
+                        next = v;
+                        break;
+                    }
+                }
+                while (next < 0 && cursor < vertexCount) {
+                    if (live[cursor] > 0)
+                        next = cursor;
+                    cursor++;
+                }
+            }
+            fanning = next;
+        }
+
+        indices.swap(output);
+    }
+
+    /* Sorts clusters so that outward facing parts of the mesh are drawn first
+    *  Clusters facing away from the mesh center tend to occlude the ones facing
+    *  into it, so early depth testing rejects more fragments.
+    *  @param indices - triangle list ordered into clusters, reordered in place
+    *  @param vertices - interleaved vertex data, position is the first 3 floats
+    *  @param offset - floats per vertex
+    *  @param clusters - first triangle of every cluster, in order
+    */
+    static void optimizeOverdraw(std::vector<GLuint>& indices, const GLfloat* vertices, int offset,
+        const std::vector<size_t>& clusters)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (clusters.size() < 2)
+            return;
+
+        // Area weighted centroid and normal of each cluster, and of the whole mesh
+        std::vector<glm::vec3> centroids(clusters.size(), glm::vec3(0));
+        std::vector<glm::vec3> normals(clusters.size(), glm::vec3(0));
+        std::vector<float> areas(clusters.size(), 0.f);
+        glm::vec3 meshCentroid(0);
+        float meshArea = 0;
+
+        for (size_t c = 0; c < clusters.size(); c++) {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            for (size_t t = clusters[c]; t < end; t++) {
+                glm::vec3 p[3];
+                for (int corner = 0; corner < 3; corner++)
+                    p[corner] = glm::make_vec3(vertices + (size_t)indices[t * 3 + corner] * offset);
+
+                glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                float area = glm::length(normal);
+                glm::vec3 center = (p[0] + p[1] + p[2]) / 3.f;
+                centroids[c] += center * area;
+                normals[c] += normal;
+                areas[c] += area;
+            }
+            meshCentroid += centroids[c];
+            meshArea += areas[c];
+        }
+        if (meshArea > 0)
+            meshCentroid /= meshArea;
+
+        std::vector<float> sortKeys(clusters.size(), 0.f);
+        for (size_t c = 0; c < clusters.size(); c++) {
+            if (areas[c] <= 0 || glm::length(normals[c]) <= 0)
+                continue;
+            centroids[c] /= areas[c];
+            sortKeys[c] = glm::dot(centroids[c] - meshCentroid, glm::normalize(normals[c]));
+        }
+
+        std::vector<size_t> order(clusters.size());
+        for (size_t c = 0; c < order.size(); c++)
+            order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) {
+            return sortKeys[a] > sortKeys[b];
+        });
+
+        std::vector<GLuint> output;
+        output.reserve(indices.size());
+        for (size_t c : order) {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+        }
+        indices.swap(output);
+    }
+
+    /* Reorders vertices by first use so that vertex fetch reads the buffer in order
+    *  Vertices that are not referenced by any triangle are dropped.
+    *  @param vertices - interleaved vertex data, reordered in place
+    *  @param offset - floats per vertex
+    *  @param indices - triangle list, remapped in place
+    *  @returns number of vertices after reordering
+    */
+    static size_t optimizeVertexFetch(std::vector<GLfloat>& vertices, int offset, std::vector<GLuint>& indices) {
+        size_t vertexCount = vertices.size() / offset;
+        const GLuint UNUSED = ~0u;
+        std::vector<GLuint> remap(vertexCount, UNUSED);
+
+        std::vector<GLfloat> output;
+        output.reserve(vertices.size());
+        GLuint next = 0;
+        for (GLuint& index : indices) {
+            if (remap[index] == UNUSED) {
+                remap[index] = next++;
+                output.insert(output.end(),
+                    vertices.begin() + (size_t)index * offset,
+                    vertices.begin() + ((size_t)index + 1) * offset);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(output);
+        return next;
+    }
+};
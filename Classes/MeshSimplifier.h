@@ -0,0 +1,273 @@
+#pragma once
+/* Builds simplified index buffers with quadric error edge collapses
+*  Edges are collapsed onto one of their existing vertices, so simplified
+*  meshes index into the same vertex buffer as the full mesh. Vertices on
+*  UV or normal seams (several vertices sharing one position) and on open
+*  borders are never moved, which keeps textures and silhouettes intact.
+*/
+class MeshSimplifier {
+public:
+    /* Index range and error of one level of detail */
+    struct Lod {
+        uint32_t indexOffset = 0;
+        uint32_t indexCount = 0;
+        // Estimated distance from the full mesh in model units
+        float error = 0;
+        uint32_t reserved = 0;
+    };
+
+    /* Simplifies a triangle list towards a target size
+    *  @param indices - triangle list to simplify
+    *  @param vertices - interleaved vertex data, position is the first 3 floats
+    *  @param offset - floats per vertex
+    *  @param vertexCount - number of vertices
+    *  @param targetIndexCount - index count to stop at
+    *  @param error - receives the largest error of the performed collapses in model units
+    *  @returns simplified triangle list, larger than the target if no further collapse is possible
+    */
+    static std::vector<GLuint> simplify(const std::vector<GLuint>& indices, const GLfloat* vertices, int offset,
+        size_t vertexCount, size_t targetIndexCount, float& error)
+    {
+        error = 0;
+        std::vector<GLuint> result(indices);
+        if (result.size() <= targetIndexCount)
+            return result;
+
+        // Group vertices by position, seam vertices share a group
+        std::vector<GLuint> group(vertexCount);
+        std::vector<int> groupSize(vertexCount, 0);
+        {
+            std::unordered_map<uint64_t, std::vector<GLuint>> buckets;
+            buckets.reserve(vertexCount);
+            for (GLuint v = 0; v < vertexCount; v++) {
+                std::vector<GLuint>& bucket = buckets[hashPosition(vertices + (size_t)v * offset)];
+                group[v] = v;
+                for (GLuint other : bucket)
+                    if (memcmp(vertices + (size_t)v * offset, vertices + (size_t)other * offset, 3 * sizeof(GLfloat)) == 0) {
+                        group[v] = other;
+                        break;
+                    }
+                if (group[v] == v)
+                    bucket.push_back(v);
+                groupSize[group[v]]++;
+            }
+        }
+
+        // Lock seams, and borders and non-manifold edges found by counting triangles per edge
+        std::vector<bool> locked(vertexCount, false);
+        for (GLuint v = 0; v < vertexCount; v++)
+            if (groupSize[group[v]] > 1)
+                locked[v] = true;
+        {
+            std::unordered_map<uint64_t, int> edgeUses;
+            edgeUses.reserve(result.size());
+            for (size_t i = 0; i < result.size(); i++) {
+                GLuint a = group[result[i]];
+                GLuint b = group[result[i - i % 3 + (i + 1) % 3]];
+                edgeUses[edgeKey(a, b)]++;
+            }
+            std::vector<bool> lockedGroup(vertexCount, false);
+            for (size_t i = 0; i < result.size(); i++) {
+                GLuint a = group[result[i]];
+                GLuint b = group[result[i - i % 3 + (i + 1) % 3]];
+                if (edgeUses[edgeKey(a, b)] != 2)
+                    lockedGroup[a] = lockedGroup[b] = true;
+            }
+            for (GLuint v = 0; v < vertexCount; v++)
+                if (lockedGroup[group[v]])
+                    locked[v] = true;
+        }
+
+        // Area weighted plane quadrics, shared by every vertex of a position group
+        std::vector<Quadric> quadrics(vertexCount);
+        for (size_t t = 0; t < result.size(); t += 3) {
+            glm::vec3 p0 = getPosition(vertices, offset, result[t]);
+            glm::vec3 p1 = getPosition(vertices, offset, result[t + 1]);
+            glm::vec3 p2 = getPosition(vertices, offset, result[t + 2]);
+            Quadric plane = Quadric::fromTriangle(p0, p1, p2);
+            for (int corner = 0; corner < 3; corner++)
+                quadrics[group[result[t + corner]]].add(plane);
+        }
+        for (GLuint v = 0; v < vertexCount; v++)
+            quadrics[v] = quadrics[group[v]];
+
+        struct Collapse {
+            GLuint from, to;
+            float cost;
+        };
+        std::vector<Collapse> candidates;
+        std::vector<GLuint> collapseTo(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<size_t> adjacencyStart(vertexCount + 1);
+        std::vector<GLuint> adjacency;
+
+        // Collapse the cheapest independent edges in passes until the target is reached
+        while (result.size() > targetIndexCount) {
+            // Triangles around each vertex
+            std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+            for (GLuint index : result)
+                adjacencyStart[index + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                adjacencyStart[v + 1] += adjacencyStart[v];
+            adjacency.resize(result.size());
+            std::vector<size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+            for (size_t i = 0; i < result.size(); i++)
+                adjacency[fill[result[i]]++] = (GLuint)(i / 3);
+
+            // Cost of moving each unlocked vertex onto each of its neighbours
+            candidates.clear();
+            for (size_t i = 0; i < result.size(); i++) {
+                GLuint from = result[i];
+                GLuint to = result[i - i % 3 + (i + 1) % 3];
+                for (int direction = 0; direction < 2; direction++) {
+                    if (!locked[from]) {
+                        Quadric sum = quadrics[from];
+                        sum.add(quadrics[to]);
+                        candidates.push_back(Collapse{ from, to, sum.evaluate(getPosition(vertices, offset, to)) });
+                    }
+                    std::swap(from, to);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) {
+                return a.cost < b.cost;
+            });
+
+            // Each collapse removes about two triangles
+            size_t wanted = (result.size() - targetIndexCount) / 6 + 1;
+            size_t collapsed = 0;
+            for (GLuint v = 0; v < vertexCount; v++) {
+                collapseTo[v] = v;
+                touched[v] = false;
+            }
+
+            for (const Collapse& collapse : candidates) {
+                if (collapsed >= wanted)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+                if (flipsTriangle(result, adjacency, adjacencyStart, vertices, offset, collapse.from, collapse.to))
+                    continue;
+
+                collapseTo[collapse.from] = collapse.to;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                error = std::max(error, std::sqrt(std::max(collapse.cost, 0.f)));
+                collapsed++;
+
+                // Neighbourhood changes, later collapses must not rely on it this pass
+                for (size_t a = adjacencyStart[collapse.from]; a < adjacencyStart[collapse.from + 1]; a++)
+                    for (int corner = 0; corner < 3; corner++)
+                        touched[result[adjacency[a] * 3 + corner]] = true;
+            }
+            if (collapsed == 0)
+                break;
+
+            // Remap indices and drop triangles that became degenerate
+            size_t write = 0;
+            for (size_t t = 0; t < result.size(); t += 3) {
+                GLuint a = collapseTo[result[t]];
+                GLuint b = collapseTo[result[t + 1]];
+                GLuint c = collapseTo[result[t + 2]];
+                if (a == b || b == c || c == a)
+                    continue;
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+            result.resize(write);
+        }
+
+        return result;
+    }
+
+private:
+    /* Symmetric 4x4 plane quadric, evaluates to the weighted mean squared distance to its planes */
+    struct Quadric {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0;
+        double weight = 0;
+
+        static Quadric fromTriangle(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2) {
+            Quadric q;
+            glm::dvec3 normal = glm::cross(glm::dvec3(p1 - p0), glm::dvec3(p2 - p0));
+            double area = glm::length(normal);
+            if (area <= 0)
+                return q;
+            normal /= area;
+            double d = -glm::dot(normal, glm::dvec3(p0));
+
+            q.a00 = normal.x * normal.x * area;
+            q.a01 = normal.x * normal.y * area;
+            q.a02 = normal.x * normal.z * area;
+            q.a11 = normal.y * normal.y * area;
+            q.a12 = normal.y * normal.z * area;
+            q.a22 = normal.z * normal.z * area;
+            q.b0 = normal.x * d * area;
+            q.b1 = normal.y * d * area;
+            q.b2 = normal.z * d * area;
+            q.c = d * d * area;
+            q.weight = area;
+            return q;
+        }
+
+        void add(const Quadric& q) {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02;
+            a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        float evaluate(glm::vec3 p) const {
+            if (weight <= 0)
+                return 0;
+            double x = p.x, y = p.y, z = p.z;
+            double result = a00 * x * x + a11 * y * y + a22 * z * z
+                + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                + 2 * (b0 * x + b1 * y + b2 * z)
+                + c;
+            return (float)(std::abs(result) / weight);
+        }
+    };
+
+    static glm::vec3 getPosition(const GLfloat* vertices, int offset, GLuint index) {
+        return glm::make_vec3(vertices + (size_t)index * offset);
+    }
+
+    static uint64_t hashPosition(const GLfloat* position) {
+        uint32_t bits[3];
+        memcpy(bits, position, sizeof(bits));
+        uint64_t hash = bits[0];
+        hash = hash * 0x9E3779B97F4A7C15ull ^ bits[1];
+        hash = hash * 0x9E3779B97F4A7C15ull ^ bits[2];
+        return hash;
+    }
+
+    static uint64_t edgeKey(GLuint a, GLuint b) {
+        if (a > b)
+            std::swap(a, b);
+        return ((uint64_t)a << 32) | b;
+    }
+
+    /* Returns true if moving a vertex onto another would flip a surrounding triangle */
+    static bool flipsTriangle(const std::vector<GLuint>& indices, const std::vector<GLuint>& adjacency,
+        const std::vector<size_t>& adjacencyStart, const GLfloat* vertices, int offset, GLuint from, GLuint to)
+    {
+        glm::vec3 target = getPosition(vertices, offset, to);
+        for (size_t a = adjacencyStart[from]; a < adjacencyStart[from + 1]; a++) {
+            const GLuint* triangle = &indices[adjacency[a] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                continue;
+
+            glm::vec3 before[3], after[3];
+            for (int corner = 0; corner < 3; corner++) {
+                before[corner] = getPosition(vertices, offset, triangle[corner]);
+                after[corner] = triangle[corner] == from ? target : before[corner];
+            }
+            glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(normalBefore, normalAfter) <= 0)
+                return true;
+        }
+        return false;
+    }
+};
@@ -10,191 +10,683 @@ protected:
     std::string warning, error;
     tinyobj::attrib_t attributes;
     std::vector<GLuint> mesh_indices;
+    // Indices packed to 16 bits when every vertex index fits
+    std::vector<GLushort> shortIndices;
     std::vector<GLfloat> fullVertexData;
+    // Counts kept for printing once the parsed OBJ is released
+    size_t shapeCount = 0;
+    size_t materialCount = 0;
+    // Mapped mesh cache image, used instead of fullVertexData and the indices when valid
+    std::shared_ptr<MappedFile> cacheImage;
+    const GLfloat* cachedVertices = nullptr;
+    const void* cachedIndices = nullptr;
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    size_t sourceVertexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    // Vertex cache efficiency before and after optimizing the mesh
+    MeshOptimizer::Stats cacheBefore, cacheAfter;
+    // Compact vertex layout, used instead of the float data when packed
+    std::vector<unsigned char> packedVertexData;
+    glm::vec3 positionMin = glm::vec3(0);
+    glm::vec3 positionExtent = glm::vec3(1);
+    VertexPacker::Error packError;
+    // Index ranges of the full mesh and its simplified levels of detail
+    std::vector<MeshSimplifier::Lod> lods;
+    int lodLevel = 0;
+    // Draw ranges of each texture, submeshCount entries for every level of detail
+    std::vector<MeshCache::Submesh> submeshes;
+    int submeshCount = 0;
+    int drawCalls = 0;
+    glm::vec3 boundsMin = glm::vec3(0);
+    glm::vec3 boundsMax = glm::vec3(0);
+    // Sphere around the bounding box, center in xyz and radius in w
+    glm::vec4 boundingSphere = glm::vec4(0);
     GLintptr uvPtr = 3 * sizeof(GLfloat);
 
-    // Texture attributes
-    int img_width, img_height, color_channels;
-    GLuint texture;
-    int norm_width, norm_height, norm_channels;
-    GLuint normTex;
+    // Source files, an evicted mesh or texture is loaded from them again
+    std::string sourcePath, texPath, normPath;
+    // Geometry was freed after upload, an evicted mesh is loaded again before uploading
+    bool geometryReleased = false;
+    size_t vertexBufferSize = 0;
+    // Mesh uploads so far, vertex arrays sharing the buffers are rebuilt when it changes
+    int uploadCount = 0;
+    // Ids in the memory budget, -1 if untracked. Textures are indexed by slot + 1, the normal map first
+    int meshAsset = -1;
+    std::vector<int> textureAssets;
+
+    // Texture attributes, images are decoded on load and freed after upload
+    Image texImage, normImage;
+    int texFormat, normFormat;
+    GLTexture texture;
+    GLTexture normTex;
+    // Diffuse textures of the OBJ materials, used by texture slots 1 and up
+    std::vector<std::string> texturePaths;
+    std::vector<Image> textureImages;
+    std::vector<GLTexture> textures;
+    // Streams textures after initBuffers(), placeholders are drawn until they arrive
+    TextureStreamer* streamer = nullptr;
+    // Loads evicted meshes and decodes evicted textures again on its workers, textures are indexed by slot + 1
+    AssetLoader* loader = nullptr;
+    std::future<std::shared_ptr<Model>> geometryReload;
+    std::vector<std::future<Image>> textureReloads;
+    // Scene hierarchy holding the world box, pushed again before a refit once the model moved
+    SceneBVH* bvh = nullptr;
+    int bvhObject = -1;
+    bool bvhDirty = false;
+    // Simplified mesh rasterized by the occlusion culler
+    std::shared_ptr<OcclusionCuller::Occluder> occluder;
 
     // Flags
     bool usingNormals;
+    bool packed = false;
+    // Drawn after opaque models, back-to-front and blended
+    bool transparent = false;
+    // Sort triangle clusters to reduce overdraw, lit fragments are expensive
+    bool reduceOverdraw = true;
+    // Build simplified levels of detail and the largest error they may show on screen
+    bool generateLods = true;
+    float lodPixelError = 1.f;
     pivot pivotPoint = OBJECT;
 
     // Draw attributes
-    GLuint VAO, VBO;
+    GLVertexArray VAO;
+    GLBuffer VBO, EBO;
     int offset;
-    glm::vec3 position, scale, rotation;
+    glm::vec3 position = glm::vec3(0), scale = glm::vec3(1), rotation = glm::vec3(0);
+    // Rotation applied to the mesh, rebuilt from the Euler degrees in rotation when they change
+    glm::quat orientation = glm::quat(1.f, 0.f, 0.f, 0.f);
+    // World matrix and the matrix that transforms normals, cached until a move marks them dirty
     glm::mat4 transformation;
+    glm::mat3 normalMatrix;
+    bool transformDirty = true;
 
     /* Loads object vertices from given filepath */
     void loadObj(std::string objPath) {
-        // Load object from file
+        // Skip parsing if the asset pack or the mesh cache holds an image for this layout
+        MeshCache::Mesh cached;
+        cached.flags = getCacheFlags();
+        AssetPack::Asset baked;
+        if (AssetPack::getMounted().find(objPath, AssetPack::MESH, baked, offset) &&
+            MeshCache::parse(baked.data, (size_t)baked.entry->dataSize, offset, cached))
+            cacheImage = baked.mapping;
+        else
+            cacheImage = MeshCache::load(objPath, offset, cached);
+        if (cacheImage) {
+            cachedVertices = cached.vertices;
+            cachedIndices = cached.indices;
+            vertexCount = cached.vertexCount;
+            indexCount = cached.indexCount;
+            sourceVertexCount = cached.sourceVertexCount;
+            indexType = cached.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            cacheBefore = cached.cacheBefore;
+            cacheAfter = cached.cacheAfter;
+            boundsMin = cached.boundsMin;
+            boundsMax = cached.boundsMax;
+            computeBoundingSphere();
+            lods = cached.lods;
+            submeshes = cached.submeshes;
+            submeshCount = (int)(submeshes.size() / lods.size());
+            texturePaths = cached.texturePaths;
+            return;
+        }
+
+        // Load object and its materials from file
+        std::string baseDir = getBaseDir(objPath);
         bool success = tinyobj::LoadObj(
             &attributes,
             &shapes,
             &material,
             &warning,
             &error,
-            objPath.c_str()
+            objPath.c_str(),
+            baseDir.c_str()
         );
-        
-        // Calculate tangents and bitangents if using normals
-        std::vector<glm::vec3> tangents;
-        std::vector<glm::vec3> bitangents;
-
-        if(usingNormals)
-            for (int i = 0; i < shapes[0].mesh.indices.size(); i += 3) {
-                tinyobj::index_t vData1 = shapes[0].mesh.indices[i];
-                tinyobj::index_t vData2 = shapes[0].mesh.indices[i + 1];
-                tinyobj::index_t vData3 = shapes[0].mesh.indices[i + 2];
-
-                glm::vec3 v1 = glm::vec3(
-                    attributes.vertices[vData1.vertex_index * 3],
-                    attributes.vertices[vData1.vertex_index * 3 + 1],
-                    attributes.vertices[vData1.vertex_index * 3 + 2]);
-
-                glm::vec3 v2 = glm::vec3(
-                    attributes.vertices[vData2.vertex_index * 3],
-                    attributes.vertices[vData2.vertex_index * 3 + 1],
-                    attributes.vertices[vData2.vertex_index * 3 + 2]);
-
-                glm::vec3 v3 = glm::vec3(
-                    attributes.vertices[vData3.vertex_index * 3],
-                    attributes.vertices[vData3.vertex_index * 3 + 1],
-                    attributes.vertices[vData3.vertex_index * 3 + 2]);
-
-                glm::vec2 uv1 = glm::vec2(
-                    attributes.texcoords[vData1.texcoord_index * 2],
-                    attributes.texcoords[vData1.texcoord_index * 2 + 1]
-                );
 
-                glm::vec2 uv2 = glm::vec2(
-                    attributes.texcoords[vData2.texcoord_index * 2],
-                    attributes.texcoords[vData2.texcoord_index * 2 + 1]
-                );
+        shapeCount = shapes.size();
+        materialCount = material.size();
 
-                glm::vec2 uv3 = glm::vec2(
-                    attributes.texcoords[vData3.texcoord_index * 2],
-                    attributes.texcoords[vData3.texcoord_index * 2 + 1]
-                );
+        // Texture slot of each material, slot 0 is the texture given to the model
+        std::vector<int> materialSlots(material.size(), 0);
+        for (size_t m = 0; m < material.size(); m++) {
+            if (material[m].diffuse_texname.empty())
+                continue;
+            std::string path = baseDir + material[m].diffuse_texname;
+            std::vector<std::string>::iterator found = std::find(texturePaths.begin(), texturePaths.end(), path);
+            materialSlots[m] = (int)(found - texturePaths.begin()) + 1;
+            if (found == texturePaths.end())
+                texturePaths.push_back(path);
+        }
 
-                glm::vec3 deltaPos1 = v2 - v1;
-                glm::vec3 deltaPos2 = v3 - v1;
+        // Build each vertex of every shape, weld duplicates and group triangles by texture
+        sourceVertexCount = 0;
+        for (tinyobj::shape_t& shape : shapes)
+            sourceVertexCount += shape.mesh.indices.size();
+        VertexWelder welder(fullVertexData, offset, sourceVertexCount);
+        std::vector<std::vector<GLuint>> slotIndices(texturePaths.size() + 1);
+        std::vector<int> slotMaterials(texturePaths.size() + 1, -1);
 
-                glm::vec2 deltaUV1 = uv2 - uv1;
-                glm::vec2 deltaUV2 = uv3 - uv1;
+        for (tinyobj::shape_t& shape : shapes)
+            for (size_t face = 0; face * 3 + 2 < shape.mesh.indices.size(); face++) {
+                const tinyobj::index_t* corners = &shape.mesh.indices[face * 3];
 
-                float r = 1.f / ((deltaUV1.x * deltaUV2.y) - deltaUV1.y * deltaUV2.x);
+                int materialId = face < shape.mesh.material_ids.size() ? shape.mesh.material_ids[face] : -1;
+                int slot = materialId >= 0 && materialId < (int)material.size() ? materialSlots[materialId] : 0;
+                if (slotMaterials[slot] < 0)
+                    slotMaterials[slot] = materialId;
 
-                glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
-                glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+                // Tangents are generated after welding, so corners only differ by position, normal and UV
+                for (int corner = 0; corner < 3; corner++) {
+                    GLfloat vertex[14] = {};
+                    readAttribute(attributes.vertices, corners[corner].vertex_index, 3, vertex);
+                    readAttribute(attributes.normals, corners[corner].normal_index, 3, vertex + 3);
+                    readAttribute(attributes.texcoords, corners[corner].texcoord_index, 2, vertex + 6);
+
+                    slotIndices[slot].push_back(welder.add(vertex));
+                }
+            }
+
+        vertexCount = welder.getVertexCount();
+
+        // One submesh per texture, each reordered for the vertex cache and overdraw
+        std::vector<GLuint> unoptimized;
+        for (std::vector<GLuint>& indices : slotIndices)
+            unoptimized.insert(unoptimized.end(), indices.begin(), indices.end());
+        cacheBefore = MeshOptimizer::analyzeVertexCache(unoptimized, vertexCount);
+
+        // Smooth tangents of the welded vertices if using normals
+        if (usingNormals)
+            TangentGenerator::generate(fullVertexData.data(), vertexCount, offset, unoptimized);
+        unoptimized.clear();
+        unoptimized.shrink_to_fit();
+
+        mesh_indices.reserve(sourceVertexCount);
+        submeshes.clear();
+        for (size_t slot = 0; slot < slotIndices.size(); slot++) {
+            std::vector<GLuint>& indices = slotIndices[slot];
+            if (indices.empty())
+                continue;
+
+            std::vector<size_t> clusters;
+            MeshOptimizer::optimizeVertexCache(indices, vertexCount, &clusters);
+            if (reduceOverdraw)
+                MeshOptimizer::optimizeOverdraw(indices, fullVertexData.data(), offset, clusters);
+
+            MeshCache::Submesh submesh;
+            submesh.indexOffset = (uint32_t)mesh_indices.size();
+            submesh.indexCount = (uint32_t)indices.size();
+            submesh.material = slotMaterials[slot];
+            submesh.texture = (int32_t)slot;
+            submeshes.push_back(submesh);
+            mesh_indices.insert(mesh_indices.end(), indices.begin(), indices.end());
+        }
+        submeshCount = (int)submeshes.size();
 
-                tangents.push_back(tangent);
-                tangents.push_back(tangent);
-                tangents.push_back(tangent);
+        // Append simplified levels of detail, they share the vertices of the full mesh
+        MeshSimplifier::Lod fullLod;
+        fullLod.indexCount = (uint32_t)mesh_indices.size();
+        lods.assign(1, fullLod);
+        if (generateLods)
+            buildLods();
 
-                bitangents.push_back(bitangent);
-                bitangents.push_back(bitangent);
-                bitangents.push_back(bitangent);
+        // Reorder vertices for fetch, then measure the full mesh
+        vertexCount = MeshOptimizer::optimizeVertexFetch(fullVertexData, offset, mesh_indices);
+        cacheAfter = MeshOptimizer::analyzeVertexCache(
+            std::vector<GLuint>(mesh_indices.begin(), mesh_indices.begin() + fullLod.indexCount), vertexCount);
+        computeBounds();
+        indexCount = mesh_indices.size();
+        packIndices();
+
+        MeshCache::save(objPath, offset, getMeshData());
+    }
+
+    /* Simplifies the full mesh into a chain of levels of detail
+    *  Each level halves the triangles of the previous one, submesh by submesh,
+    *  and is appended to the indices with its own submesh ranges.
+    */
+    void buildLods() {
+        std::vector<std::vector<GLuint>> previous(submeshCount);
+        for (int s = 0; s < submeshCount; s++)
+            previous[s].assign(mesh_indices.begin() + submeshes[s].indexOffset,
+                mesh_indices.begin() + submeshes[s].indexOffset + submeshes[s].indexCount);
+
+        for (int level = 1; level < MeshCache::MAX_LODS; level++) {
+            std::vector<std::vector<GLuint>> simplified(submeshCount);
+            size_t before = 0, after = 0;
+            float levelError = 0;
+            for (int s = 0; s < submeshCount; s++) {
+                float error;
+                simplified[s] = MeshSimplifier::simplify(previous[s],
+                    fullVertexData.data(), offset, vertexCount, previous[s].size() / 6 * 3, error);
+                levelError = std::max(levelError, error);
+                before += previous[s].size();
+                after += simplified[s].size();
             }
-        
-        // Assign vertex indices of mesh to array
-        for (int i = 0; i < shapes[0].mesh.indices.size(); i++) {
-            tinyobj::index_t vData = shapes[0].mesh.indices[i];
 
-            int vertexIndex = vData.vertex_index * 3;
-            int normalIndex = vData.normal_index * 3;
-            int uvIndex = vData.texcoord_index * 2;
+            // Stop once seams and borders keep the mesh from shrinking further
+            if (after == 0 || after * 10 > before * 9)
+                break;
 
-            fullVertexData.push_back(attributes.vertices[vertexIndex]);
-            fullVertexData.push_back(attributes.vertices[vertexIndex + 1]);
-            fullVertexData.push_back(attributes.vertices[vertexIndex + 2]);
+            MeshSimplifier::Lod lod;
+            lod.indexOffset = (uint32_t)mesh_indices.size();
+            lod.indexCount = (uint32_t)after;
+            lod.error = lods.back().error + levelError;
+            lods.push_back(lod);
 
-            fullVertexData.push_back(attributes.normals[normalIndex]);
-            fullVertexData.push_back(attributes.normals[normalIndex + 1]);
-            fullVertexData.push_back(attributes.normals[normalIndex + 2]);
+            for (int s = 0; s < submeshCount; s++) {
+                MeshOptimizer::optimizeVertexCache(simplified[s], vertexCount);
 
-            fullVertexData.push_back(attributes.texcoords[uvIndex]);
-            fullVertexData.push_back(attributes.texcoords[uvIndex + 1]);
+                MeshCache::Submesh submesh = submeshes[s];
+                submesh.indexOffset = (uint32_t)mesh_indices.size();
+                submesh.indexCount = (uint32_t)simplified[s].size();
+                submeshes.push_back(submesh);
+                mesh_indices.insert(mesh_indices.end(), simplified[s].begin(), simplified[s].end());
+            }
+            previous.swap(simplified);
+        }
+    }
 
-            // Add tangents and bitangents if using normals
-            if (usingNormals) {
-                fullVertexData.push_back(tangents[i].x);
-                fullVertexData.push_back(tangents[i].y);
-                fullVertexData.push_back(tangents[i].z);
+    /* Returns directory of a file path including the trailing separator */
+    static std::string getBaseDir(std::string path) {
+        size_t separator = path.find_last_of("/\\");
+        if (separator == std::string::npos)
+            return "";
+        return path.substr(0, separator + 1);
+    }
+
+    /* Copies an attribute of an OBJ vertex, or zeros if the vertex has none
+    *  @param values - attribute array of the OBJ
+    *  @param index - attribute index of the vertex, -1 if missing
+    *  @param size - components per attribute
+    *  @param out - receives size floats
+    */
+    static void readAttribute(const std::vector<tinyobj::real_t>& values, int index, int size, GLfloat* out) {
+        if (index < 0 || (size_t)(index + 1) * size > values.size())
+            return;
+        for (int i = 0; i < size; i++)
+            out[i] = values[(size_t)index * size + i];
+    }
+
+    /* Computes bounding box of the vertex positions */
+    void computeBounds() {
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t v = 0; v < vertexCount; v++) {
+            glm::vec3 position = glm::make_vec3(&fullVertexData[v * offset]);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+        if (vertexCount == 0)
+            boundsMin = boundsMax = glm::vec3(0);
+        computeBoundingSphere();
+    }
 
-                fullVertexData.push_back(bitangents[i].x);
-                fullVertexData.push_back(bitangents[i].y);
-                fullVertexData.push_back(bitangents[i].z);
+    /* Computes the sphere around the bounding box */
+    void computeBoundingSphere() {
+        boundingSphere = glm::vec4((boundsMin + boundsMax) * 0.5f, glm::length(boundsMax - boundsMin) * 0.5f);
+    }
+
+    /* Rebuilds the orientation from the Euler degrees, turned around Y, then X, then Z */
+    void updateOrientation() {
+        orientation = glm::angleAxis(glm::radians(rotation[0]), glm::vec3(0.f, 1.f, 0.f)) *
+            glm::angleAxis(glm::radians(rotation[1]), glm::vec3(1.f, 0.f, 0.f)) *
+            glm::angleAxis(glm::radians(rotation[2]), glm::vec3(0.f, 0.f, 1.f));
+    }
+
+    /* Rebuilds the cached matrices from position, orientation and scale if a move marked them dirty
+    *  Object pivots rotate in place, origin pivots also turn the position around the origin.
+    */
+    void updateTransformation() {
+        if (!transformDirty)
+            return;
+        glm::mat3 rotationMatrix = glm::mat3_cast(orientation);
+        glm::vec3 translation = pivotPoint == ORIGIN ? rotationMatrix * position : position;
+        transformation = glm::mat4(
+            glm::vec4(rotationMatrix[0] * scale.x, 0.f),
+            glm::vec4(rotationMatrix[1] * scale.y, 0.f),
+            glm::vec4(rotationMatrix[2] * scale.z, 0.f),
+            glm::vec4(translation, 1.f));
+
+        // Inverse transpose of rotation * scale, which is rotation / scale
+        normalMatrix = glm::mat3(rotationMatrix[0] / scale.x, rotationMatrix[1] / scale.y, rotationMatrix[2] / scale.z);
+        transformDirty = false;
+    }
+
+#ifdef USE_SSE
+    /* Rebuilds the matrices of four models at once, one model per lane */
+    static void updateTransformationsSse(Model* const* group) {
+        // Transpose the quaternions, positions and scales of the four models into one lane per model
+        __m128 x = _mm_loadu_ps(&group[0]->orientation.x), y = _mm_loadu_ps(&group[1]->orientation.x);
+        __m128 z = _mm_loadu_ps(&group[2]->orientation.x), w = _mm_loadu_ps(&group[3]->orientation.x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128 positions[4], scales[4];
+        for (int lane = 0; lane < 4; lane++) {
+            positions[lane] = loadVec3(group[lane]->position);
+            scales[lane] = loadVec3(group[lane]->scale);
+        }
+        _MM_TRANSPOSE4_PS(positions[0], positions[1], positions[2], positions[3]);
+        _MM_TRANSPOSE4_PS(scales[0], scales[1], scales[2], scales[3]);
+        __m128 originPivot = _mm_castsi128_ps(_mm_set_epi32(-(group[3]->pivotPoint == ORIGIN),
+            -(group[2]->pivotPoint == ORIGIN), -(group[1]->pivotPoint == ORIGIN), -(group[0]->pivotPoint == ORIGIN)));
+
+        // Rotation matrix of each quaternion, by column
+        const __m128 two = _mm_set1_ps(2.f), ones = _mm_set1_ps(1.f);
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+        __m128 rotation[3][3] = {
+            { _mm_sub_ps(ones, _mm_mul_ps(two, _mm_add_ps(yy, zz))), _mm_mul_ps(two, _mm_add_ps(xy, wz)),
+                _mm_mul_ps(two, _mm_sub_ps(xz, wy)) },
+            { _mm_mul_ps(two, _mm_sub_ps(xy, wz)), _mm_sub_ps(ones, _mm_mul_ps(two, _mm_add_ps(xx, zz))),
+                _mm_mul_ps(two, _mm_add_ps(yz, wx)) },
+            { _mm_mul_ps(two, _mm_add_ps(xz, wy)), _mm_mul_ps(two, _mm_sub_ps(yz, wx)),
+                _mm_sub_ps(ones, _mm_mul_ps(two, _mm_add_ps(xx, yy))) }
+        };
+
+        // Origin pivots take the rotated position as translation
+        __m128 translation[3];
+        for (int row = 0; row < 3; row++) {
+            __m128 rotated = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rotation[0][row], positions[0]),
+                _mm_mul_ps(rotation[1][row], positions[1])), _mm_mul_ps(rotation[2][row], positions[2]));
+            translation[row] = _mm_or_ps(_mm_and_ps(originPivot, rotated), _mm_andnot_ps(originPivot, positions[row]));
+        }
+
+        // Transpose back, each column of each model is one store
+        __m128 zero = _mm_setzero_ps();
+        for (int column = 0; column < 3; column++) {
+            __m128 linear[4], normal[4];
+            __m128 inverseScale = _mm_div_ps(ones, scales[column]);
+            for (int row = 0; row < 3; row++) {
+                linear[row] = _mm_mul_ps(rotation[column][row], scales[column]);
+                normal[row] = _mm_mul_ps(rotation[column][row], inverseScale);
+            }
+            linear[3] = normal[3] = zero;
+            _MM_TRANSPOSE4_PS(linear[0], linear[1], linear[2], linear[3]);
+            _MM_TRANSPOSE4_PS(normal[0], normal[1], normal[2], normal[3]);
+            for (int lane = 0; lane < 4; lane++) {
+                _mm_storeu_ps(&group[lane]->transformation[column].x, linear[lane]);
+                storeVec3(group[lane]->normalMatrix[column], normal[lane]);
             }
         }
+        __m128 lastRow = ones;
+        _MM_TRANSPOSE4_PS(translation[0], translation[1], translation[2], lastRow);
+        __m128 moved[4] = { translation[0], translation[1], translation[2], lastRow };
+        for (int lane = 0; lane < 4; lane++) {
+            _mm_storeu_ps(&group[lane]->transformation[3].x, moved[lane]);
+            group[lane]->transformDirty = false;
+        }
+    }
+
+    /* Loads a vec3 into the low lanes of a register, the last lane is 0 */
+    static __m128 loadVec3(const glm::vec3& value) {
+        __m128 xy = _mm_castpd_ps(_mm_load_sd((const double*)&value.x));
+        return _mm_movelh_ps(xy, _mm_load_ss(&value.z));
     }
 
-    /* Loads texture from path */
-    void loadTex(std::string texPath, int colorMode) {
-        unsigned char* tex_bytes = stbi_load(texPath.c_str(),
-            &img_width,
-            &img_height,
-            &color_channels,
-            0);
-
-        glGenTextures(1, &texture);
-        glActiveTexture(GL_TEXTURE0); // "Layer"
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glTexImage2D(
-            GL_TEXTURE_2D, // Type
-            0, // Index
-            colorMode, // Image format (rgb = jpeg/png with alpha, rgba = png/images with alpha)
-            img_width,
-            img_height,
-            0, // Border
-            colorMode,
-            GL_UNSIGNED_BYTE, // Texture data type
-            tex_bytes
+    /* Stores the low three lanes of a register */
+    static void storeVec3(glm::vec3& value, __m128 lanes) {
+        _mm_storel_pi((__m64*)&value.x, lanes);
+        _mm_store_ss(&value.z, _mm_movehl_ps(lanes, lanes));
+    }
+#endif
+
+    /* Marks the cached matrices and the box in the scene hierarchy stale after a move, both are rebuilt later
+    *  so that moves between frames are batched by updateTransformations()
+    */
+    void markTransformDirty() {
+        transformDirty = true;
+        bvhDirty = bvh != nullptr;
+    }
+
+    /* Returns texture to draw with, a placeholder while it is still streaming */
+    GLuint resolveTexture(GLuint tex) {
+        return streamer ? streamer->resolve(tex) : tex;
+    }
+
+    /* Returns texture of a texture slot */
+    GLuint getTexture(int slot) {
+        if (slot <= 0 || slot > (int)textures.size())
+            return resolveSlot(0);
+        return resolveSlot(slot);
+    }
+
+    /* Returns texture to draw with for a texture slot, -1 for the normal map
+    *  A placeholder while it is streaming, or while it is decoded again after eviction.
+    */
+    GLuint resolveSlot(int slot) {
+        GLuint tex = getSlotTexture(slot).get();
+        if (tex == 0 && streamer && slot + 1 < (int)textureReloads.size() && textureReloads[slot + 1].valid())
+            return streamer->getPlaceholder(slot < 0 ? TextureStreamer::NORMAL : TextureStreamer::COLOR);
+        return resolveTexture(tex);
+    }
+
+    /* Returns mesh cache flags for the processing options of this model */
+    uint32_t getCacheFlags() {
+        uint32_t flags = 0;
+        if (reduceOverdraw)
+            flags |= MeshCache::OPTIMIZED_OVERDRAW;
+        if (generateLods)
+            flags |= MeshCache::GENERATED_LODS;
+        return flags;
+    }
+
+    /* Packs indices to 16 bits if every vertex can be addressed with them */
+    void packIndices() {
+        shortIndices.clear();
+        indexType = GL_UNSIGNED_INT;
+        if (vertexCount > 65536)
+            return;
+
+        shortIndices.assign(mesh_indices.begin(), mesh_indices.end());
+        mesh_indices.clear();
+        mesh_indices.shrink_to_fit();
+        indexType = GL_UNSIGNED_SHORT;
+    }
+
+    /* Returns interleaved vertex data from the cache image or the parsed OBJ */
+    const GLfloat* getVertexData() {
+        if (cacheImage)
+            return cachedVertices;
+        return fullVertexData.data();
+    }
+
+    /* Returns indices from the cache image or the welded OBJ */
+    const void* getIndexData() {
+        if (cacheImage)
+            return cachedIndices;
+        if (indexType == GL_UNSIGNED_SHORT)
+            return shortIndices.data();
+        return mesh_indices.data();
+    }
+
+    /* Returns size of one index in bytes */
+    int getIndexSize() {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    }
+
+    /* Uploads decoded image to a new texture and frees the image
+    *  @param image - decoded image
+    *  @param colorMode - internal format (rgb = jpeg/png with alpha, rgba = png/images with alpha),
+    *    pixels are read in the format of the image channels
+    *  @param unit - texture unit to bind the texture to
+    *  @param placeholder - texture drawn while streaming
+    *  @returns texture owning the name
+    */
+    GLTexture uploadTex(Image& image, int colorMode, GLenum unit, TextureStreamer::Placeholder placeholder) {
+        if (streamer) {
+            GLTexture tex = GLTexture(streamer->queue(image, colorMode, placeholder));
+            image.release();
+            return tex;
+        }
+
+        GLTexture tex = GLTexture::generate();
+        GLState::getCurrent().bindTexture(unit, GL_TEXTURE_2D, tex.get()); // "Layer"
+
+        // Baked images carry their mip chain, rows of small levels are not 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = 0; level < image.getLevels(); level++)
+            glTexImage2D(
+                GL_TEXTURE_2D, // Type
+                level, // Index
+                colorMode, // Image format
+                Image::getLevelExtent(image.getWidth(), level),
+                Image::getLevelExtent(image.getHeight(), level),
+                0, // Border
+                image.getFormat(),
+                GL_UNSIGNED_BYTE, // Texture data type
+                image.getLevelPixels(level)
+            );
+        if (const GLint* swizzle = image.getSwizzle())
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+
+        if (image.getLevels() == 1)
+            glGenerateMipmap(GL_TEXTURE_2D);
+        else
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.getLevels() - 1);
+        image.release();
+        return tex;
+    }
+
+    /* Returns file of a texture slot, -1 for the normal map */
+    std::string getSlotPath(int slot) {
+        if (slot < 0)
+            return normPath;
+        return slot == 0 ? texPath : texturePaths[slot - 1];
+    }
+
+    /* Returns texture of a texture slot, -1 for the normal map */
+    GLTexture& getSlotTexture(int slot) {
+        if (slot < 0)
+            return normTex;
+        return slot == 0 ? texture : textures[slot - 1];
+    }
+
+    /* Uploads the image of a texture slot, -1 for the normal map, and frees the image
+    *  @returns bytes of the texture and its mip levels
+    */
+    size_t uploadSlot(int slot, Image& image) {
+        size_t bytes = image.getSize();
+        if (slot < 0)
+            normTex = uploadTex(image, normFormat, GL_TEXTURE1, TextureStreamer::NORMAL);
+        else if (slot == 0)
+            texture = uploadTex(image, texFormat, GL_TEXTURE0, TextureStreamer::COLOR);
+        else
+            textures[slot - 1] = uploadTex(image, image.getFormat(), GL_TEXTURE0, TextureStreamer::COLOR);
+        return bytes;
+    }
+
+    /* Uploads the vertex and element buffers and records them in a new vertex array */
+    void uploadGeometry() {
+        VAO = GLVertexArray::generate();
+        VBO = GLBuffer::generate();
+        EBO = GLBuffer::generate();
+        vertexBufferSize = packed ? packedVertexData.size() : sizeof(GLfloat) * offset * vertexCount;
+
+        // Bind VAO
+        GLState::getCurrent().bindVertexArray(VAO.get());
+        // Create an array buffer for vertex positions
+        glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+        // Add size of vertex array (bytes) and contents to buffer
+        glBufferData(
+            GL_ARRAY_BUFFER,
+            vertexBufferSize,
+            packed ? (const void*)packedVertexData.data() : (const void*)getVertexData(),
+            GL_STATIC_DRAW
         );
 
-        glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(tex_bytes);
-    }
-
-    /* Loads normal texture from path */
-    void loadNorm(std::string texPath, int colorMode) {
-        unsigned char* norm_bytes = stbi_load(texPath.c_str(),
-            &norm_width,
-            &norm_height,
-            &norm_channels,
-            0);
-
-        glGenTextures(1, &normTex);
-        glActiveTexture(GL_TEXTURE1); // "Layer"
-        glBindTexture(GL_TEXTURE_2D, normTex);
-
-        glTexImage2D(
-            GL_TEXTURE_2D, // Type
-            0, // Index
-            colorMode, // Image format (rgb = jpeg/png with alpha, rgba = png/images with alpha)
-            norm_width,
-            norm_height,
-            0, // Border
-            colorMode,
-            GL_UNSIGNED_BYTE, // Texture data type
-            norm_bytes
+        // Element buffer is recorded in the VAO
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+        glBufferData(
+            GL_ELEMENT_ARRAY_BUFFER,
+            getIndexSize() * indexCount,
+            getIndexData(),
+            GL_STATIC_DRAW
         );
 
-        glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(norm_bytes);
+        // Instruct VAO how to interpret array buffer
+        setAttribPointers();
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState::getCurrent().bindVertexArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        uploadCount++;
+    }
 
-        //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        //glTexParamateri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    /* Loads released geometry again from the asset pack, the mesh cache or the OBJ, then uploads it */
+    void reloadGeometry() {
+        if (geometryReleased) {
+            loadObj(sourcePath);
+            if (packed)
+                packVertices();
+        }
+        uploadGeometry();
+        if (geometryReleased)
+            releaseGeometry();
+    }
+
+    /* Queues loading the released geometry on the loader workers, into a model that only holds the mesh */
+    std::future<std::shared_ptr<Model>> queueGeometryReload() {
+        std::string path = sourcePath;
+        int layout = offset;
+        bool normals = usingNormals, overdraw = reduceOverdraw, levels = generateLods, pack = packed;
+        return loader->load(path, [=] {
+            std::shared_ptr<Model> mesh = std::make_shared<Model>();
+            mesh->offset = layout;
+            mesh->usingNormals = normals;
+            mesh->reduceOverdraw = overdraw;
+            mesh->generateLods = levels;
+            mesh->loadObj(path);
+            if (pack)
+                mesh->packVertices();
+            return mesh;
+        });
+    }
+
+    /* Takes the vertex and index data of a model loaded from the same source, then uploads and releases it */
+    void uploadReloadedGeometry(Model& mesh) {
+        cacheImage = std::move(mesh.cacheImage);
+        cachedVertices = mesh.cachedVertices;
+        cachedIndices = mesh.cachedIndices;
+        fullVertexData.swap(mesh.fullVertexData);
+        mesh_indices.swap(mesh.mesh_indices);
+        shortIndices.swap(mesh.shortIndices);
+        packedVertexData.swap(mesh.packedVertexData);
+        indexType = mesh.indexType;
+        uploadGeometry();
+        releaseGeometry();
+    }
+
+    /* Returns bytes of the geometry kept in memory, mapped cache images excluded */
+    size_t getGeometryBytes() {
+        size_t bytes = fullVertexData.capacity() * sizeof(GLfloat) + packedVertexData.capacity() +
+            mesh_indices.capacity() * sizeof(GLuint) + shortIndices.capacity() * sizeof(GLushort) +
+            (attributes.vertices.capacity() + attributes.vertex_weights.capacity() + attributes.normals.capacity() +
+            attributes.texcoords.capacity() + attributes.texcoord_ws.capacity() + attributes.colors.capacity()) *
+            sizeof(tinyobj::real_t);
+        for (const tinyobj::shape_t& shape : shapes)
+            bytes += shape.mesh.indices.capacity() * sizeof(tinyobj::index_t) +
+                shape.mesh.num_face_vertices.capacity() + shape.mesh.material_ids.capacity() * sizeof(int) +
+                shape.mesh.smoothing_group_ids.capacity() * sizeof(unsigned int);
+        return bytes;
+    }
+
+    /* Returns bytes of the vertex and element buffers */
+    size_t getBufferBytes() {
+        return vertexBufferSize + (size_t)getIndexSize() * indexCount;
     }
 
 public:
     Model() {}
+    // Owns its GL objects, so models are moved and referenced but never copied
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    Model(Model&&) = default;
+    Model& operator=(Model&&) = default;
 
+    /* Loads object and decodes its textures without making GL calls,
+    *  so models can be constructed on worker threads. Call initBuffers()
+    *  on the GL thread before drawing.
+    */
     Model(std::string objPath,
         std::string texPath, int texFormat,
         bool useNormals, std::string normPath, int normFormat,
@@ -202,104 +694,284 @@ public:
     {
         // Initialize flags
         usingNormals = useNormals;
+        offset = 8;
+        if (useNormals)
+            offset = 14;
 
         // Load object from file
+        sourcePath = objPath;
         loadObj(objPath);
-        // Load texture if specified
+        // Decode texture if specified
+        this->texPath = texPath;
+        this->normPath = normPath;
+        this->texFormat = texFormat;
         if(!texPath.empty())
-            loadTex(texPath, texFormat);
-        // Load normals if specified
+            texImage.load(texPath);
+        // Decode normals if specified
+        this->normFormat = normFormat;
         if (!normPath.empty())
-            loadNorm(texPath, normFormat);
+            normImage.load(normPath);
+        // Decode material textures
+        textureImages.resize(texturePaths.size());
+        for (size_t i = 0; i < texturePaths.size(); i++)
+            textureImages[i].load(texturePaths[i]);
+
+        // Mip chains of loose images are built here instead of by the driver on the GL thread
+        texImage.buildMipChain();
+        normImage.buildMipChain();
+        for (Image& image : textureImages)
+            image.buildMipChain();
 
         // Initialize draw vectors
-        offset = 8;
-        if (useNormals)
-            offset = 14;
         position = pos;
         scale = glm::vec3(size);
         rotation = rot;
+        updateOrientation();
     }
 
-    /* Initialize buffers for drawing */
-    void initBuffers() {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
+    /* Packs vertex data into the compact layout of VertexPacker
+    *  Does not make GL calls, call before initBuffers(). Models drawn with packed
+    *  vertices need shaders compiled with PACKED_VERTICES defined.
+    */
+    void packVertices() {
+        packError = VertexPacker::pack(getVertexData(), vertexCount, offset,
+            packedVertexData, positionMin, positionExtent);
+        packed = true;
 
-        // Bind VAO
-        glBindVertexArray(VAO);
-        // Create an array buffer for vertex positions
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // Add size of vertex array (bytes) and contents to buffer    
-        glBufferData(
-            GL_ARRAY_BUFFER,
-            sizeof(GL_FLOAT) * fullVertexData.size(),
-            fullVertexData.data(),
-            GL_STATIC_DRAW
-        );
+        // Float vertices are no longer needed
+        fullVertexData.clear();
+        fullVertexData.shrink_to_fit();
+    }
 
-        // Instruct VAO how to interpret array buffer
-        glVertexAttribPointer(
-            0,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            offset * sizeof(GL_FLOAT),
-            (void*)0
-        );
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(
-            1,
-            3,
-            GL_FLOAT,
-            GL_TRUE,
-            offset * sizeof(GL_FLOAT),
-            (void*)(3 * sizeof(GLfloat))
-        );
-        glEnableVertexAttribArray(1);
-
-        glVertexAttribPointer(
-            2, // Tex coords
-            2,
-            GL_FLOAT,
-            GL_FALSE,
-            offset * sizeof(GL_FLOAT),
-            (void*)(6 * sizeof(GLfloat))
-        );
-        glEnableVertexAttribArray(2);
+    /* Builds the occluder mesh from the coarsest level of detail
+    *  Does not make GL calls, call before packVertices() while the float vertices are available.
+    *  @param targetTriangles - triangle count to simplify the occluder to
+    */
+    void buildOccluder(size_t targetTriangles) {
+        const GLfloat* vertices = getVertexData();
+        std::vector<glm::vec3> positions(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            positions[v] = glm::make_vec3(vertices + v * offset);
 
-        if (usingNormals) {
-            glVertexAttribPointer(
-                3,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                offset * sizeof(GL_FLOAT),
-                (void*)(8 * sizeof(GLfloat))
-            );
-            glEnableVertexAttribArray(3);
+        const MeshSimplifier::Lod& coarsest = lods.back();
+        std::vector<GLuint> indices(coarsest.indexCount);
+        for (uint32_t i = 0; i < coarsest.indexCount; i++)
+            indices[i] = getIndexSize() == sizeof(GLushort) ?
+                ((const GLushort*)getIndexData())[coarsest.indexOffset + i] :
+                ((const GLuint*)getIndexData())[coarsest.indexOffset + i];
 
-            glVertexAttribPointer(
-                4,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                offset * sizeof(GL_FLOAT),
-                (void*)(11 * sizeof(GLfloat))
-            );
-            glEnableVertexAttribArray(4);
+        occluder = std::make_shared<OcclusionCuller::Occluder>(
+            OcclusionCuller::makeOccluder(positions, indices, targetTriangles));
+    }
+
+    /* Returns processed mesh data for writing a mesh cache image
+    *  Points into this model, call before packVertices().
+    */
+    MeshCache::Mesh getMeshData() {
+        MeshCache::Mesh mesh;
+        mesh.vertices = getVertexData();
+        mesh.vertexCount = vertexCount;
+        mesh.indices = getIndexData();
+        mesh.indexCount = indexCount;
+        mesh.indexSize = getIndexSize();
+        mesh.sourceVertexCount = sourceVertexCount;
+        mesh.flags = getCacheFlags();
+        mesh.cacheBefore = cacheBefore;
+        mesh.cacheAfter = cacheAfter;
+        mesh.boundsMin = boundsMin;
+        mesh.boundsMax = boundsMax;
+        mesh.lods = lods;
+        mesh.submeshes = submeshes;
+        mesh.texturePaths = texturePaths;
+        return mesh;
+    }
+
+    /* Initialize buffers and textures for drawing, each is accounted in the memory budget
+    *  @param textureStreamer (optional) - streams the textures in over the next frames
+    *    instead of uploading them before returning
+    *  @param assetLoader (optional) - loads evicted meshes and decodes evicted textures again on its workers.
+    *    Draws are skipped until the mesh is ready, and placeholders drawn until the textures are. Textures
+    *    also need the streamer. Without them, assets are loaded again on the GL thread when drawn.
+    */
+    void initBuffers(TextureStreamer* textureStreamer = nullptr, AssetLoader* assetLoader = nullptr) {
+        uploadGeometry();
+        MemoryBudget& budget = MemoryBudget::get();
+        meshAsset = budget.track(sourcePath, MemoryBudget::MESHES);
+        budget.setUsage(meshAsset, getGeometryBytes(), getBufferBytes());
+
+        // Upload decoded textures, the normal map first
+        streamer = textureStreamer;
+        loader = assetLoader;
+        textures.clear();
+        textures.resize(textureImages.size());
+        textureAssets.assign(textureImages.size() + 2, -1);
+        textureReloads.clear();
+        textureReloads.resize(textureImages.size() + 2);
+        for (int slot = -1; slot <= (int)textureImages.size(); slot++) {
+            Image& image = slot < 0 ? normImage : slot == 0 ? texImage : textureImages[slot - 1];
+            if (!image.isLoaded())
+                continue;
+            int& asset = textureAssets[slot + 1];
+            asset = budget.track(getSlotPath(slot), MemoryBudget::TEXTURES);
+            budget.setUsage(asset, 0, uploadSlot(slot, image));
         }
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    /* Frees the geometry kept in memory once uploaded, keeping the counts, bounds, levels of detail
+    *  and submeshes that drawing needs. Call after initBuffers(), and after packVertices(), buildOccluder()
+    *  and getMeshData(), which read it. An evicted mesh is loaded again before it is uploaded.
+    *  Geometry parsed from the OBJ is kept without a loader, loading it again would stall the GL thread.
+    */
+    void releaseGeometry() {
+        if (!cacheImage && !loader)
+            return;
+        std::vector<tinyobj::shape_t>().swap(shapes);
+        std::vector<tinyobj::material_t>().swap(material);
+        attributes = tinyobj::attrib_t();
+        std::vector<GLuint>().swap(mesh_indices);
+        std::vector<GLushort>().swap(shortIndices);
+        std::vector<GLfloat>().swap(fullVertexData);
+        std::vector<unsigned char>().swap(packedVertexData);
+        cacheImage.reset();
+        cachedVertices = nullptr;
+        cachedIndices = nullptr;
+        geometryReleased = true;
+        if (meshAsset >= 0)
+            MemoryBudget::get().setUsage(meshAsset, 0, VAO.get() != 0 ? getBufferBytes() : 0);
+    }
+
+    /* Frees the buffers and textures the memory budget flagged, they are uploaded again when next drawn
+    *  Textures still streaming in are kept until they arrive.
+    */
+    void applyEvictions() {
+        MemoryBudget& budget = MemoryBudget::get();
+        if (meshAsset >= 0 && budget.isFlagged(meshAsset) && VAO.get() != 0) {
+            VAO.reset();
+            VBO.reset();
+            EBO.reset();
+            budget.release(meshAsset);
+        }
+        for (int slot = -1; slot + 1 < (int)textureAssets.size(); slot++) {
+            int asset = textureAssets[slot + 1];
+            if (asset < 0 || !budget.isFlagged(asset))
+                continue;
+            GLTexture& tex = getSlotTexture(slot);
+            if (tex.get() == 0 || resolveTexture(tex.get()) != tex.get())
+                continue;
+            tex.reset();
+            budget.release(asset);
+        }
+    }
+
+    /* Uploads what the memory budget evicted and marks the model drawn in this frame, call before drawing
+    *  With a loader, evicted meshes and textures are loaded on its workers and uploaded in the first frame
+    *  after they are ready. Placeholders are drawn for textures until then.
+    *  @returns false while the mesh is still loading, the model is not drawn then
+    */
+    bool makeResident() {
+        if (meshAsset < 0)
+            return true;
+        MemoryBudget& budget = MemoryBudget::get();
+        if (VAO.get() == 0 && geometryReleased && loader) {
+            if (!geometryReload.valid())
+                geometryReload = queueGeometryReload();
+            if (geometryReload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                uploadReloadedGeometry(*geometryReload.get());
+                budget.restore(meshAsset, getBufferBytes());
+            }
+        }
+        else if (VAO.get() == 0) {
+            reloadGeometry();
+            budget.restore(meshAsset, getBufferBytes());
+        }
+        budget.markDrawn(meshAsset);
+
+        for (int slot = -1; slot + 1 < (int)textureAssets.size(); slot++) {
+            int asset = textureAssets[slot + 1];
+            if (asset < 0)
+                continue;
+            if (getSlotTexture(slot).get() == 0) {
+                std::future<Image>& reload = textureReloads[slot + 1];
+                if (loader && streamer && !reload.valid()) {
+                    std::string path = getSlotPath(slot);
+                    reload = loader->load(path, [path] {
+                        Image image;
+                        image.load(path);
+                        image.buildMipChain();
+                        return image;
+                    });
+                }
+                if (!loader || !streamer) {
+                    Image image;
+                    image.load(getSlotPath(slot));
+                    image.buildMipChain();
+                    budget.restore(asset, uploadSlot(slot, image));
+                }
+                else if (reload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    Image image = reload.get();
+                    budget.restore(asset, uploadSlot(slot, image));
+                }
+            }
+            budget.markDrawn(asset);
+        }
+        return VAO.get() != 0;
     }
 
     /* Getters */
     bool isUsingNormals() {
         return usingNormals;
     }
+    size_t getVertexCount() {
+        return vertexCount;
+    }
+    int getOffset() {
+        return offset;
+    }
+    size_t getSourceVertexCount() {
+        return sourceVertexCount;
+    }
+    bool isPacked() {
+        return packed;
+    }
+    int getLodCount() {
+        return (int)lods.size();
+    }
+    int getLodLevel() {
+        return lodLevel;
+    }
+    size_t getTriangleCount(int level = 0) {
+        return lods[level].indexCount / 3;
+    }
+    int getSubmeshCount() {
+        return submeshCount;
+    }
+    int getDrawCalls() {
+        return drawCalls;
+    }
+    // Changes whenever the buffers are uploaded again after an eviction
+    int getUploadCount() {
+        return uploadCount;
+    }
+    glm::vec4 getBoundingSphere() {
+        return boundingSphere;
+    }
+    glm::vec3 getBoundsMin() {
+        return boundsMin;
+    }
+    glm::vec3 getBoundsMax() {
+        return boundsMax;
+    }
+    int getBvhObject() {
+        return bvhObject;
+    }
+    // Null until buildOccluder() is called
+    const OcclusionCuller::Occluder* getOccluder() {
+        return occluder.get();
+    }
+    glm::mat4 getTransformation() {
+        updateTransformation();
+        return transformation;
+    }
     glm::vec3 getPos() {
         return position;
     }
@@ -310,87 +982,336 @@ public:
     /* Setters */
     void setPivotOrigin() {
         pivotPoint = ORIGIN;
+        markTransformDirty();
     }
     void setPivotObject() {
         pivotPoint = OBJECT;
+        markTransformDirty();
     }
     void setPosition(glm::vec3 position) {
         this->position = position;
+        markTransformDirty();
     }
     void setRotation(glm::vec3 rotation) {
         this->rotation = rotation;
+        updateOrientation();
+        markTransformDirty();
+    }
+    void setTransparent(bool transparent) {
+        this->transparent = transparent;
     }
 
     /* Methods */
+    /* Binds the vertex and element buffers to the bound vertex array and describes the vertex layout
+    *  Also used by instanced models to share this mesh in their own vertex arrays.
+    */
+    void setAttribPointers() {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+        if (packed)
+            VertexPacker::setAttribPointers(usingNormals);
+        else {
+            glVertexAttribPointer(
+                0,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                offset * sizeof(GL_FLOAT),
+                (void*)0
+            );
+            glEnableVertexAttribArray(0);
+
+            glVertexAttribPointer(
+                1,
+                3,
+                GL_FLOAT,
+                GL_TRUE,
+                offset * sizeof(GL_FLOAT),
+                (void*)(3 * sizeof(GLfloat))
+            );
+            glEnableVertexAttribArray(1);
+
+            glVertexAttribPointer(
+                2, // Tex coords
+                2,
+                GL_FLOAT,
+                GL_FALSE,
+                offset * sizeof(GL_FLOAT),
+                (void*)(6 * sizeof(GLfloat))
+            );
+            glEnableVertexAttribArray(2);
+
+            if (usingNormals) {
+                glVertexAttribPointer(
+                    3,
+                    3,
+                    GL_FLOAT,
+                    GL_FALSE,
+                    offset * sizeof(GL_FLOAT),
+                    (void*)(8 * sizeof(GLfloat))
+                );
+                glEnableVertexAttribArray(3);
+
+                glVertexAttribPointer(
+                    4,
+                    3,
+                    GL_FLOAT,
+                    GL_FALSE,
+                    offset * sizeof(GL_FLOAT),
+                    (void*)(11 * sizeof(GLfloat))
+                );
+                glEnableVertexAttribArray(4);
+            }
+        }
+    }
+
+    /* Returns the inverse transpose of the upper 3x3 of a transform, which keeps normals perpendicular
+    *  A rotation scaled by s on every axis only needs dividing by s squared, so the inverse is skipped.
+    *  @param uniformScale - true if the transform scales every axis alike
+    */
+    static glm::mat3 computeNormalMatrix(const glm::mat4& transform, bool uniformScale) {
+        glm::mat3 linear = glm::mat3(transform);
+        if (uniformScale)
+            return linear / glm::dot(linear[0], linear[0]);
+        return glm::transpose(glm::inverse(linear));
+    }
+
     /* Draws object
     *  @param transformationLoc - uniform index to pass transformation matrix
     *  @param tex0 - uniform index to assign texture
     *  @param tex1 - uniform index to assign normals
+    *  @param normalMatrixLoc (optional) - uniform index to pass normal matrix
     */
-    void draw(unsigned int transformationLoc, unsigned int tex0, unsigned int tex1 = -1) {
-        glBindVertexArray(VAO);
-
-        transformation = glm::mat4(1.0f);
-
-        // NOTE: multiplication order
-        // https://stackoverflow.com/questions/52770929/rotate-object-around-origin-as-it-faces-origin-in-opengl-with-glm
-        // Changes order of transformation based on pivoting on origin or object
-        if (pivotPoint == ORIGIN) {
-            // Rotate
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[0]),
-                glm::vec3(0.f, 1.f, 0.f));
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[1]),
-                glm::vec3(1.f, 0.f, 0.f));
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[2]),
-                glm::vec3(0.f, 0.f, 1.f));
-
-            // Translate
-            transformation = glm::translate(transformation, position);
-        }
-        else {
-            // Translate
-            transformation = glm::translate(transformation, position);
-
-            // Rotate
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[0]),
-                glm::vec3(0.f, 1.f, 0.f));
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[1]),
-                glm::vec3(1.f, 0.f, 0.f));
-            transformation = glm::rotate(
-                transformation,
-                glm::radians(rotation[2]),
-                glm::vec3(0.f, 0.f, 1.f));
+    void draw(GLint transformationLoc, GLint tex0, GLint tex1 = -1, GLint normalMatrixLoc = -1) {
+        if (!makeResident()) {
+            drawCalls = 0;
+            return;
         }
 
-        // Scale
-        transformation = glm::scale(transformation, scale);
+        // Binds and sampler units that are already set are skipped
+        GLState& state = GLState::getCurrent();
+        state.bindVertexArray(VAO.get());
+
+        updateTransformation();
 
         // Position object/s
         glUniformMatrix4fv(transformationLoc, 1, GL_FALSE, glm::value_ptr(transformation));
+        ShaderManager::getCallCounts().uploads++;
+        if (normalMatrixLoc != -1) {
+            glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+            ShaderManager::getCallCounts().uploads++;
+        }
         
-        // Bind texture to object and draw
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(tex0, 0);
+        // Bind texture unit of object textures
+        if (state.setUniform(tex0, 0))
+            ShaderManager::getCallCounts().uploads++;
 
         // If included, bind normals to object and draw
         if (tex1 != -1) {
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, normTex);
-            glUniform1i(tex1, 1);
+            state.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, resolveSlot(-1));
+            if (state.setUniform(tex1, 1))
+                ShaderManager::getCallCounts().uploads++;
         }
 
-        glDrawArrays(GL_TRIANGLES, 0, fullVertexData.size() / offset);
+        // Draw selected level of detail
+        drawSubmeshes(1, lodLevel);
+    }
+
+    /* Draws a level of detail with the bound vertex array, one call per texture
+    *  @param instanceCount - instances of each submesh
+    *  @param level - level of detail to draw
+    */
+    void drawSubmeshes(GLsizei instanceCount, int level) {
+        GLState& state = GLState::getCurrent();
+
+        // Dequantization range of packed positions, read by the shader as constant attributes
+        if (packed) {
+            glVertexAttrib3fv(5, glm::value_ptr(positionMin));
+            glVertexAttrib3fv(6, glm::value_ptr(positionExtent));
+        }
+
+        drawCalls = 0;
+        for (int s = 0; s < submeshCount; s++) {
+            const MeshCache::Submesh& submesh = submeshes[level * submeshCount + s];
+            if (submesh.indexCount == 0)
+                continue;
+
+            state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, getTexture(submesh.texture));
+            if (instanceCount == 1)
+                glDrawElements(GL_TRIANGLES, submesh.indexCount, indexType,
+                    (void*)((size_t)submesh.indexOffset * getIndexSize()));
+            else
+                glDrawElementsInstanced(GL_TRIANGLES, submesh.indexCount, indexType,
+                    (void*)((size_t)submesh.indexOffset * getIndexSize()), instanceCount);
+            drawCalls++;
+        }
+    }
+
+    /* Queues the submeshes of the selected level of detail, one item per texture
+    *  @param queue - render queue of the frame
+    *  @param shader - program to draw with
+    *  @param cameraPos - position of the active camera, for sorting
+    */
+    void submit(RenderQueue& queue, ShaderManager& shader, glm::vec3 cameraPos) {
+        drawCalls = 0;
+        if (!makeResident())
+            return;
+        updateTransformation();
+
+        RenderQueue::Item item;
+        item.shader = &shader;
+        item.vertexArray = VAO.get();
+        item.indexType = indexType;
+        item.normalTexture = usingNormals ? resolveSlot(-1) : 0;
+        item.packed = packed;
+        item.positionMin = positionMin;
+        item.positionExtent = positionExtent;
+        item.transparent = transparent;
+        item.distance = glm::length(glm::vec3(getWorldSphere()) - cameraPos);
+        item.transform = transformation;
+        item.normalMatrix = normalMatrix;
+
+        for (int s = 0; s < submeshCount; s++) {
+            const MeshCache::Submesh& submesh = submeshes[lodLevel * submeshCount + s];
+            if (submesh.indexCount == 0)
+                continue;
+
+            item.indexCount = submesh.indexCount;
+            item.indexOffset = (size_t)submesh.indexOffset * getIndexSize();
+            item.texture = getTexture(submesh.texture);
+            queue.add(item);
+            drawCalls++;
+        }
+    }
+
+    /* Prints vertex counts and buffer sizes before and after welding
+    *  @param name - model name to print
+    */
+    void printVertexCounts(std::string name) {
+        size_t expandedBytes = sourceVertexCount * offset * sizeof(GLfloat);
+        size_t indexedBytes = vertexCount * offset * sizeof(GLfloat) + indexCount * getIndexSize();
+        std::cout << "  " << name << ": "
+            << sourceVertexCount << " -> " << vertexCount << " vertices, "
+            << expandedBytes / 1024 << " KB -> " << indexedBytes / 1024 << " KB"
+            << (indexType == GL_UNSIGNED_SHORT ? " (16-bit indices)" : " (32-bit indices)") << std::endl;
+    }
+
+    /* Prints vertex buffer size and largest errors of the packed layout
+    *  @param name - model name to print
+    */
+    void printPackError(std::string name) {
+        if (!packed)
+            return;
+        std::cout << "  " << name << ": "
+            << vertexCount * offset * sizeof(GLfloat) / 1024 << " KB -> " << vertexBufferSize / 1024 << " KB"
+            << ", position " << packError.position
+            << " (" << packError.position / std::max(glm::length(positionExtent), 1e-6f) * 100.f << "% of bounds)"
+            << ", normal " << packError.normal << " deg";
+        if (usingNormals)
+            std::cout << ", tangent " << packError.tangent << " deg";
+        std::cout << ", uv " << packError.uv << std::endl;
+    }
+
+    /* Prints vertex cache efficiency before and after optimizing the mesh
+    *  @param name - model name to print
+    */
+    void printCacheStats(std::string name) {
+        std::cout << "  " << name << ": ACMR " << cacheBefore.acmr << " -> " << cacheAfter.acmr
+            << ", ATVR " << cacheBefore.atvr << " -> " << cacheAfter.atvr << std::endl;
+    }
+
+    /* Picks the coarsest level of detail whose error stays below lodPixelError on screen
+    *  @param projection - projection matrix of the active camera
+    *  @param cameraPos - position of the active camera
+    *  @param viewportHeight - height of the viewport in pixels
+    */
+    void selectLod(glm::mat4 projection, glm::vec3 cameraPos, float viewportHeight) {
+        lodLevel = 0;
+        if (lods.size() < 2)
+            return;
+
+        glm::vec4 sphere = getWorldSphere();
+        glm::vec3 center = glm::vec3(sphere);
+        float radius = sphere.w;
+
+        // Pixels covered by one world unit at the nearest point of the sphere
+        float pixelsPerUnit = projection[1][1] * viewportHeight * 0.5f;
+        bool isPerspective = projection[3][3] == 0.f;
+        if (isPerspective)
+            pixelsPerUnit /= std::max(glm::length(center - cameraPos) - radius, 0.001f);
+
+        for (int level = (int)lods.size() - 1; level > 0; level--)
+            if (lods[level].error * scale.x * pixelsPerUnit <= lodPixelError) {
+                lodLevel = level;
+                return;
+            }
+    }
+
+    /* Returns the bounding sphere in world space, center in xyz and radius in w, scale is uniform */
+    glm::vec4 getWorldSphere() {
+        updateTransformation();
+        glm::vec3 center = glm::vec3(transformation * glm::vec4(glm::vec3(boundingSphere), 1.f));
+        return glm::vec4(center, boundingSphere.w * scale.x);
+    }
+
+    /* Returns the world space box around the transformed bounding box
+    *  @param worldMin - receives the smallest corner
+    *  @param worldMax - receives the largest corner
+    */
+    void getWorldBounds(glm::vec3& worldMin, glm::vec3& worldMax) {
+        updateTransformation();
+        SceneBVH::transformBox(transformation, boundsMin, boundsMax, worldMin, worldMax);
+    }
+
+    /* Adds the world box to a scene hierarchy, pushed again by updateBvh() after the model moves
+    *  @returns object id in the hierarchy
+    */
+    int attachBvh(SceneBVH& sceneBvh) {
+        glm::vec3 worldMin, worldMax;
+        getWorldBounds(worldMin, worldMax);
+        bvh = &sceneBvh;
+        bvhObject = sceneBvh.insert(worldMin, worldMax);
+        bvhDirty = false;
+        return bvhObject;
+    }
+
+    /* Moves the world box in the scene hierarchy if the model moved since, call before the hierarchy is refit */
+    void updateBvh() {
+        if (!bvhDirty)
+            return;
+        glm::vec3 worldMin, worldMax;
+        getWorldBounds(worldMin, worldMax);
+        bvh->update(bvhObject, worldMin, worldMax);
+        bvhDirty = false;
+    }
+
+    /* Prints submeshes of the full mesh and the draw calls they need
+    *  @param name - model name to print
+    */
+    void printSubmeshes(std::string name) {
+        std::cout << "  " << name << ": " << submeshCount << " draw calls for "
+            << texturePaths.size() + 1 << " texture slots";
+        if (shapeCount > 0)
+            std::cout << ", " << shapeCount << " shapes and " << materialCount << " materials";
+        std::cout << std::endl;
+        for (int s = 0; s < submeshCount; s++)
+            std::cout << "    texture " << submeshes[s].texture << ", material " << submeshes[s].material
+                << ": " << submeshes[s].indexCount / 3 << " tris" << std::endl;
+    }
+
+    /* Prints triangle counts and errors of each level of detail
+    *  @param name - model name to print
+    */
+    void printLods(std::string name) {
+        std::cout << "  " << name << ":";
+        for (size_t level = 0; level < lods.size(); level++) {
+            std::cout << " LOD" << level << " " << lods[level].indexCount / 3 << " tris";
+            if (level > 0)
+                std::cout << " (error " << lods[level].error << ")";
+            if (level + 1 < lods.size())
+                std::cout << ",";
+        }
+        std::cout << std::endl;
     }
 
     /* Modifies position of camera
@@ -398,6 +1319,7 @@ public:
     */
     void modPos(glm::vec3 value) {
         position += value;
+        markTransformDirty();
     }
 
     /* Modifies rotation of camera
@@ -405,11 +1327,54 @@ public:
     */
     void adjustRotate(glm::vec3 newRot) {
         rotation += newRot;
+        updateOrientation();
+        markTransformDirty();
+    }
+
+    /* Rebuilds the matrices of the models that moved since their last use in one pass, then pushes the
+    *  boxes of those in a scene hierarchy. Models are otherwise rebuilt one at a time when they are next
+    *  drawn or queried.
+    *  @param models - models to update, clean ones are skipped
+    *  @param useSimd (optional) - use SSE if compiled in, otherwise scalar code
+    */
+    static void updateTransformations(std::vector<Model>& models, bool useSimd = true) {
+        // Kept between calls, so a frame only allocates when more models move than ever before
+        static thread_local std::vector<Model*> dirty;
+        dirty.clear();
+        for (Model& model : models)
+            if (model.transformDirty)
+                dirty.push_back(&model);
+
+        size_t i = 0;
+#ifdef USE_SSE
+        if (useSimd)
+            for (; i + 4 <= dirty.size(); i += 4)
+                updateTransformationsSse(&dirty[i]);
+#endif
+        for (; i < dirty.size(); i++)
+            dirty[i]->updateTransformation();
+
+        // Boxes from the rebuilt matrices, also of models rebuilt by a query since they moved
+        for (Model& model : models)
+            model.updateBvh();
     }
 
-    /* Deletion of buffers after object use */
+    /* Deletion of buffers after object use, call before the context is destroyed */
     void cleanup() {
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &VBO);
+        VAO.reset();
+        VBO.reset();
+        EBO.reset();
+        texture.reset();
+        normTex.reset();
+        textures.clear();
+        // Decodes still running finish on the workers and are dropped
+        textureReloads.clear();
+
+        MemoryBudget& budget = MemoryBudget::get();
+        budget.untrack(meshAsset);
+        for (int asset : textureAssets)
+            budget.untrack(asset);
+        meshAsset = -1;
+        textureAssets.clear();
     }
 };
\ No newline at end of file
@@ -0,0 +1,436 @@
+#pragma once
+/* Software occlusion culling against a low resolution depth buffer
+*  Simplified meshes of a few large models are rasterized on the CPU into a
+*  WIDTH x HEIGHT buffer of NDC depth, four pixels at a time with SSE where it
+*  is available, and reduced into min and max depth pyramids. A box is hidden
+*  if its nearest corner lies behind the farthest occluder depth of every texel
+*  its screen rectangle covers; coarse texels are only refined where the box
+*  depth falls between their min and max. Frames run on a worker thread one
+*  frame behind the renderer: collect() returns the flags of the frame
+*  submitted before, so an object coming out from behind an occluder can show
+*  up a frame late.
+*/
+class OcclusionCuller {
+public:
+    static const int WIDTH = 256;
+    static const int HEIGHT = 128;
+
+    /* Simplified closed mesh in model space, counter-clockwise front faces */
+    struct Occluder {
+        std::vector<glm::vec3> vertices;
+        std::vector<GLuint> indices;
+    };
+
+    /* Work of the collected frames since the stats were last reset */
+    struct Stats {
+        size_t frames = 0;
+        size_t tested = 0;
+        size_t rejected = 0;
+        size_t triangles = 0;
+        double rasterMs = 0;
+        double testMs = 0;
+    };
+
+private:
+    // Inputs of a frame and the results the worker writes
+    struct Job {
+        glm::mat4 viewProjection;
+        std::vector<const Occluder*> occluders;
+        std::vector<glm::mat4> occluderTransforms;
+        std::vector<int> objects;
+        std::vector<glm::vec3> boxMin, boxMax;
+        size_t objectCount = 0;
+        bool useSimd = true;
+
+        std::vector<unsigned char> visible;
+        size_t rejected = 0;
+        size_t triangles = 0;
+        double rasterMs = 0;
+        double testMs = 0;
+    };
+
+    // Clip space w below which vertices are treated as behind the camera
+    static constexpr float MIN_W = 1e-5f;
+
+    Job job;
+    // Flags of the last collected frame, one per object id
+    std::vector<unsigned char> results;
+    Stats stats;
+
+    // Level 0 is the depth buffer, each further level halves both sides
+    std::vector<std::vector<float>> minLevels, maxLevels;
+    int levelCount = 0;
+    std::vector<glm::vec4> clipVertices;
+
+    // Frame handed to the worker, set by submit() until collect() takes its flags
+    bool pending = false;
+    // Handoff to the worker, a persistent thread so submitting a frame allocates nothing
+    std::mutex jobMutex;
+    std::condition_variable jobChanged;
+    bool jobQueued = false;
+    bool jobFinished = false;
+    bool stopping = false;
+    std::thread worker;
+
+    /* Edge function of u to v, positive left of it, as a * x + b * y + c */
+    static glm::vec3 getEdge(glm::vec3 u, glm::vec3 v) {
+        return glm::vec3(u.y - v.y, v.x - u.x, (v.y - u.y) * u.x - (v.x - u.x) * u.y);
+    }
+
+    /* Writes the nearer of a triangle and the buffer depth into each covered pixel
+    *  @param a, b, c - pixel coordinates in xy and NDC depth in z
+    */
+    void rasterizeTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, bool useSimd) {
+        // Back faces and degenerate triangles are skipped, occluders are closed
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (area <= 0.f)
+            return;
+
+        int x0 = std::max(0, (int)std::floor(std::min(a.x, std::min(b.x, c.x))));
+        int x1 = std::min(WIDTH - 1, (int)std::ceil(std::max(a.x, std::max(b.x, c.x))));
+        int y0 = std::max(0, (int)std::floor(std::min(a.y, std::min(b.y, c.y))));
+        int y1 = std::min(HEIGHT - 1, (int)std::ceil(std::max(a.y, std::max(b.y, c.y))));
+        if (x0 > x1 || y0 > y1)
+            return;
+
+        // Each edge weighs the vertex opposite it, depth is linear in screen space
+        glm::vec3 edge0 = getEdge(b, c), edge1 = getEdge(c, a), edge2 = getEdge(a, b);
+        glm::vec3 depthPlane = (edge0 * a.z + edge1 * b.z + edge2 * c.z) / area;
+
+        float* depth = minLevels[0].data();
+#ifdef USE_SSE
+        if (useSimd) {
+            rasterizeSse(edge0, edge1, edge2, depthPlane, x0 & ~3, x1, y0, y1, depth);
+            return;
+        }
+#endif
+        for (int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            for (int x = x0; x <= x1; x++) {
+                float px = x + 0.5f;
+                if (edge0.x * px + edge0.y * py + edge0.z < 0.f || edge1.x * px + edge1.y * py + edge1.z < 0.f ||
+                    edge2.x * px + edge2.y * py + edge2.z < 0.f)
+                    continue;
+                float z = depthPlane.x * px + depthPlane.y * py + depthPlane.z;
+                float& pixel = depth[y * WIDTH + x];
+                pixel = std::min(pixel, z);
+            }
+        }
+    }
+
+#ifdef USE_SSE
+    /* Rasterizes four pixels at a time from a column that is a multiple of 4, WIDTH is one too */
+    static void rasterizeSse(glm::vec3 edge0, glm::vec3 edge1, glm::vec3 edge2, glm::vec3 depthPlane,
+        int x0, int x1, int y0, int y1, float* depth)
+    {
+        const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        for (int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            // Row constants of each plane, x is added per block
+            __m128 row0 = _mm_set1_ps(edge0.y * py + edge0.z);
+            __m128 row1 = _mm_set1_ps(edge1.y * py + edge1.z);
+            __m128 row2 = _mm_set1_ps(edge2.y * py + edge2.z);
+            __m128 rowZ = _mm_set1_ps(depthPlane.y * py + depthPlane.z);
+
+            for (int x = x0; x <= x1; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge0.x), px), row0);
+                __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge1.x), px), row1);
+                __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge2.x), px), row2);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)),
+                    _mm_cmpge_ps(w2, zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthPlane.x), px), rowZ);
+                float* pixels = depth + y * WIDTH + x;
+                __m128 current = _mm_loadu_ps(pixels);
+                __m128 nearer = _mm_min_ps(current, z);
+                _mm_storeu_ps(pixels, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+        }
+    }
+#endif
+
+    /* Clears the depth buffer and rasterizes the occluders of the job */
+    void rasterizeOccluders() {
+        std::fill(minLevels[0].begin(), minLevels[0].end(), 1.f);
+        job.triangles = 0;
+
+        for (size_t o = 0; o < job.occluders.size(); o++) {
+            const Occluder& occluder = *job.occluders[o];
+            glm::mat4 transform = job.viewProjection * job.occluderTransforms[o];
+            clipVertices.resize(occluder.vertices.size());
+            for (size_t v = 0; v < occluder.vertices.size(); v++)
+                clipVertices[v] = transform * glm::vec4(occluder.vertices[v], 1.f);
+
+            for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+                glm::vec3 screen[3];
+                bool clipped = false;
+                for (int corner = 0; corner < 3; corner++) {
+                    glm::vec4 clip = clipVertices[occluder.indices[i + corner]];
+                    // Triangles reaching in front of the near plane are left out rather than clipped
+                    if (clip.w < MIN_W || clip.z < -clip.w) {
+                        clipped = true;
+                        break;
+                    }
+                    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+                    screen[corner] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT,
+                        std::min(ndc.z, 1.f));
+                }
+                if (clipped)
+                    continue;
+                rasterizeTriangle(screen[0], screen[1], screen[2], job.useSimd);
+                job.triangles++;
+            }
+        }
+    }
+
+    /* Reduces each level into the next, nearest and farthest of every 2x2 block */
+    void buildPyramid() {
+        maxLevels[0] = minLevels[0];
+        for (int level = 1; level < levelCount; level++) {
+            int width = WIDTH >> level, height = HEIGHT >> level;
+            const std::vector<float>& finerMin = minLevels[level - 1];
+            const std::vector<float>& finerMax = maxLevels[level - 1];
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++) {
+                    int finer = y * 2 * width * 2 + x * 2;
+                    int below = finer + width * 2;
+                    minLevels[level][y * width + x] = std::min(std::min(finerMin[finer], finerMin[finer + 1]),
+                        std::min(finerMin[below], finerMin[below + 1]));
+                    maxLevels[level][y * width + x] = std::max(std::max(finerMax[finer], finerMax[finer + 1]),
+                        std::max(finerMax[below], finerMax[below + 1]));
+                }
+        }
+    }
+
+    /* Returns true if a depth is in front of the occluders somewhere in a pixel rectangle
+    *  @param level - pyramid level of the texels to test
+    *  @param x0, y0, x1, y1 - rectangle in level 0 pixels, inclusive
+    */
+    bool testRect(int level, int x0, int y0, int x1, int y1, float nearZ) {
+        int width = WIDTH >> level;
+        for (int ty = y0 >> level; ty <= y1 >> level; ty++)
+            for (int tx = x0 >> level; tx <= x1 >> level; tx++) {
+                float farthest = maxLevels[level][ty * width + tx];
+                if (nearZ > farthest)
+                    continue;
+                if (nearZ <= minLevels[level][ty * width + tx])
+                    return true;
+
+                // Partly covered, refine within this texel
+                int size = 1 << level;
+                if (testRect(level - 1, std::max(x0, tx * size), std::max(y0, ty * size),
+                    std::min(x1, tx * size + size - 1), std::min(y1, ty * size + size - 1), nearZ))
+                    return true;
+            }
+        return false;
+    }
+
+    /* Returns true if a world box may be visible past the rasterized occluders */
+    bool testBox(glm::vec3 boxMin, glm::vec3 boxMax) {
+        glm::vec2 rectMin = glm::vec2(FLT_MAX), rectMax = glm::vec2(-FLT_MAX);
+        float nearZ = FLT_MAX;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 point = glm::vec3(corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y,
+                corner & 4 ? boxMax.z : boxMin.z);
+            glm::vec4 clip = job.viewProjection * glm::vec4(point, 1.f);
+            // Boxes reaching the near plane are kept
+            if (clip.w < MIN_W || clip.z < -clip.w)
+                return true;
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            rectMin = glm::min(rectMin, glm::vec2(ndc));
+            rectMax = glm::max(rectMax, glm::vec2(ndc));
+            nearZ = std::min(nearZ, ndc.z);
+        }
+
+        // Rectangle in pixels, boxes off screen are left to frustum culling
+        int x0 = std::max(0, (int)std::floor((rectMin.x * 0.5f + 0.5f) * WIDTH));
+        int x1 = std::min(WIDTH - 1, (int)std::floor((rectMax.x * 0.5f + 0.5f) * WIDTH));
+        int y0 = std::max(0, (int)std::floor((rectMin.y * 0.5f + 0.5f) * HEIGHT));
+        int y1 = std::min(HEIGHT - 1, (int)std::floor((rectMax.y * 0.5f + 0.5f) * HEIGHT));
+        if (x0 > x1 || y0 > y1)
+            return true;
+
+        // Coarsest level needed for the rectangle to span at most 2x2 texels
+        int level = 0;
+        while (level + 1 < levelCount && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            level++;
+        return testRect(level, x0, y0, x1, y1, nearZ);
+    }
+
+    /* Runs a job on the worker */
+    void runJob() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        rasterizeOccluders();
+        buildPyramid();
+        std::chrono::steady_clock::time_point rasterized = std::chrono::steady_clock::now();
+
+        job.visible.assign(job.objectCount, 1);
+        job.rejected = 0;
+        for (size_t i = 0; i < job.objects.size(); i++)
+            if (!testBox(job.boxMin[i], job.boxMax[i])) {
+                job.visible[job.objects[i]] = 0;
+                job.rejected++;
+            }
+
+        job.rasterMs = std::chrono::duration<double, std::milli>(rasterized - start).count();
+        job.testMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - rasterized).count();
+    }
+
+    /* Runs queued jobs until the culler is destroyed */
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        while (true) {
+            jobChanged.wait(lock, [this] { return stopping || jobQueued; });
+            if (stopping)
+                return;
+            jobQueued = false;
+            lock.unlock();
+            runJob();
+            lock.lock();
+            jobFinished = true;
+            jobChanged.notify_all();
+        }
+    }
+
+public:
+    OcclusionCuller() {
+        for (int width = WIDTH, height = HEIGHT; width >= 2 && height >= 2; width /= 2, height /= 2) {
+            minLevels.push_back(std::vector<float>((size_t)width * height, 1.f));
+            maxLevels.push_back(std::vector<float>((size_t)width * height, 1.f));
+            levelCount++;
+        }
+        worker = std::thread([this] { workerLoop(); });
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    /* Finishes the pending frame and joins the worker */
+    ~OcclusionCuller() {
+        collect();
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobChanged.notify_all();
+        worker.join();
+    }
+
+    /* Returns true if the SSE path is compiled in */
+    static bool hasSimd() {
+#ifdef USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* Builds an occluder from a triangle list, welding positions and simplifying it towards a target size
+    *  @param positions - vertex positions
+    *  @param indices - triangle list into positions
+    *  @param targetTriangles - triangle count to simplify to
+    */
+    static Occluder makeOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+        size_t targetTriangles)
+    {
+        // Seams split vertices that share a position, welding lets the simplifier collapse across them
+        std::vector<GLfloat> welded;
+        std::vector<GLuint> weldedIndices;
+        {
+            VertexWelder welder(welded, 3, positions.size());
+            for (GLuint index : indices)
+                weldedIndices.push_back(welder.add(glm::value_ptr(positions[index])));
+        }
+        size_t weldedCount = welded.size() / 3;
+
+        float error;
+        std::vector<GLuint> simplified = MeshSimplifier::simplify(weldedIndices, welded.data(), 3, weldedCount,
+            targetTriangles * 3, error);
+
+        // Keep only the vertices the simplified triangles use
+        Occluder occluder;
+        std::vector<GLuint> remap(weldedCount, UINT32_MAX);
+        for (GLuint index : simplified) {
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = (GLuint)occluder.vertices.size();
+                occluder.vertices.push_back(glm::make_vec3(&welded[(size_t)index * 3]));
+            }
+            occluder.indices.push_back(remap[index]);
+        }
+        return occluder;
+    }
+
+    /* Waits for the frame submitted last and takes its flags, call before starting the next frame */
+    void collect() {
+        if (!pending)
+            return;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobChanged.wait(lock, [this] { return jobFinished; });
+            jobFinished = false;
+        }
+        pending = false;
+        results.swap(job.visible);
+
+        stats.frames++;
+        stats.tested += job.objects.size();
+        stats.rejected += job.rejected;
+        stats.triangles += job.triangles;
+        stats.rasterMs += job.rasterMs;
+        stats.testMs += job.testMs;
+    }
+
+    /* Starts the inputs of a frame, collecting the one still pending
+    *  @param viewProjection - projection * view of the camera
+    *  @param objectCount - number of object ids the flags cover
+    *  @param useSimd (optional) - rasterize with SSE if compiled in, otherwise scalar code
+    */
+    void begin(glm::mat4 viewProjection, size_t objectCount, bool useSimd = true) {
+        collect();
+        job.viewProjection = viewProjection;
+        job.objectCount = objectCount;
+        job.useSimd = useSimd;
+        job.occluders.clear();
+        job.occluderTransforms.clear();
+        job.objects.clear();
+        job.boxMin.clear();
+        job.boxMax.clear();
+    }
+
+    /* Adds an occluder to the frame, it must stay alive until the frame is collected */
+    void addOccluder(const Occluder& occluder, glm::mat4 transform) {
+        job.occluders.push_back(&occluder);
+        job.occluderTransforms.push_back(transform);
+    }
+
+    /* Adds an object to test by its world box, objects not added stay visible */
+    void addObject(int object, glm::vec3 boxMin, glm::vec3 boxMax) {
+        job.objects.push_back(object);
+        job.boxMin.push_back(boxMin);
+        job.boxMax.push_back(boxMax);
+    }
+
+    /* Queues the frame on the worker, its flags are taken by the next collect() */
+    void submit() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobQueued = true;
+        }
+        pending = true;
+        jobChanged.notify_all();
+    }
+
+    /* Returns false if the last collected frame found the object hidden */
+    bool isVisible(int object) {
+        return (size_t)object >= results.size() || results[object];
+    }
+
+    /* Getters */
+    Stats& getStats() {
+        return stats;
+    }
+};
@@ -25,6 +25,7 @@ public:
     void panCamera(glm::vec3 position) {
         this->position += position;
         this->target += position;
+        markDirty();
     }
 
     /* Moves camera in the XZ axis
@@ -39,5 +40,6 @@ public:
         //Update camera Z position and target
         this->position.z -= yValue;
         this->target.z -= yValue;
+        markDirty();
     }
 };
\ No newline at end of file
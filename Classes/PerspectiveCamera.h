@@ -2,20 +2,12 @@
 
 class PerspectiveCamera : public Camera {
 private:
-    // Third person projection. Small zFar for lower render distance
-    glm::mat4 base_projection_tpp = glm::perspective(
-        glm::radians(60.f),
-        1.f,
-        .1f,
-        200.f
-    );
-    // First person projection. Large zFar for higher render distance
-    glm::mat4 base_projection_fpp = glm::perspective(
-        glm::radians(60.f),
-        1.f,
-        .1f,
-        500.f
-    );
+    // Vertical field of view in degrees and the near clip distance
+    float fov = 60.f;
+    float zNear = .1f;
+    // Third person uses a small zFar for lower render distance, first person a large one
+    // With reversed depth both see to infinity, the float depth buffer keeps distant geometry apart
+    float zFar = 200.f;
 
     float pitch = -25.f;
     float yaw = 90.f;
@@ -25,12 +17,17 @@ public:
         this->position = position;
         this->target = target;
         this->worldUp = worldUp;
-        if (istpp)
-            projection = base_projection_tpp;
-        else
-            projection = base_projection_fpp;
+        zFar = istpp ? 200.f : 500.f;
     }
 
+protected:
+    glm::mat4 makeProjection(bool infiniteFar) override {
+        if (infiniteFar)
+            return glm::infinitePerspective(glm::radians(fov), 1.f, zNear);
+        return glm::perspective(glm::radians(fov), 1.f, zNear, zFar);
+    }
+
+public:
     /* Methods */
     /* Revolves the camera around a position based on a pitch and yaw
     *  @param yawDelta - yaw distance to revolve
@@ -61,6 +58,7 @@ public:
 
         // Sets the target to the specified position
         target = pos;
+        markDirty();
     }
 
     /* Positions TPP camera
@@ -81,6 +79,7 @@ public:
 
         //sets the position of the player to the target of the camera
         target = pos;
+        markDirty();
     }
 
     /* Positions TPP camera
@@ -108,6 +107,7 @@ public:
         //adds the x and y offsets to the current camera target
         target[0] += offsetX;
         target[2] += offsetY;
+        markDirty();
     }
 
     /* Sets yaw camera yaw and pitch given rotation values */
@@ -53,7 +53,6 @@ public:
             texPath.c_str(), texFormat,
             true, normPath, normFormat,
             pos, size, rot);
-        obj.initBuffers();
 
         // Create submarine light
         flashlight = PointLight(
@@ -68,14 +67,35 @@ public:
         tpp.adjustCameraTpp(obj.getPos(), obj.getRotation() - objRotOffset);
     }
 
+    /* Packs vertex data of player model into the compact layout */
+    void packVertices() {
+        obj.packVertices();
+    }
+
+    /* Initialize buffers of player model, call on the GL thread
+    *  @param textureStreamer (optional) - streams the model textures in over the next frames
+    *  @param assetLoader (optional) - decodes evicted textures again on its workers
+    */
+    void initBuffers(TextureStreamer* textureStreamer = nullptr, AssetLoader* assetLoader = nullptr) {
+        obj.initBuffers(textureStreamer, assetLoader);
+    }
+
+    /* Adds the submarine to a scene hierarchy, kept updated as it moves
+    *  @returns object id in the hierarchy
+    */
+    int attachBvh(SceneBVH& bvh) {
+        return obj.attachBvh(bvh);
+    }
+
     /* Getters */
     bool isFPP() {
         return activeCamera == FPP;
     }
-    Model getPlayer() {
+    Model& getPlayer() {
         return obj;
     }
-    PerspectiveCamera getActiveCamera() {
+    // Returned by reference, so its cached matrices are kept and reused by the renderer
+    PerspectiveCamera& getActiveCamera() {
         if (activeCamera == FPP)
             return fpp;
         else
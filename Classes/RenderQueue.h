@@ -0,0 +1,290 @@
+#pragma once
+/* Collects the draws of a frame, sorts them by packed 64-bit keys and issues them with few state changes
+*  Opaque keys order by program, then coarse distance (the float exponent), then mesh and texture, then
+*  fine distance, so opaque draws run roughly front-to-back for early depth rejection while draws that
+*  share state stay next to each other. Transparent draws follow, back-to-front. Consecutive draws of the
+*  same mesh, textures and program are merged into one instanced call of up to MAX_INSTANCES, the shader
+*  reads the transform and normal matrix of each instance from the transforms[] and normalMatrices[]
+*  uniform arrays.
+*  GL thread only.
+*/
+class RenderQueue {
+public:
+    // Length of the transforms[] and normalMatrices[] arrays of the model shaders
+    static const int MAX_INSTANCES = 32;
+
+    /* One submesh to draw */
+    struct Item {
+        ShaderManager* shader;
+        GLuint vertexArray;
+        GLenum indexType;
+        GLsizei indexCount;
+        // Bytes into the element buffer
+        size_t indexOffset;
+        GLuint texture;
+        // 0 if the model has no normal map
+        GLuint normalTexture;
+        // Dequantization range, set as constant attributes if packed
+        bool packed;
+        glm::vec3 positionMin, positionExtent;
+        bool transparent;
+        // Distance from the camera, for sorting
+        float distance;
+        glm::mat4 transform;
+        glm::mat3 normalMatrix;
+    };
+
+    /* Work of the flushes since the stats were last reset */
+    struct Stats {
+        size_t items = 0;
+        size_t drawCalls = 0;
+        size_t stateChanges = 0;
+        double sortMs = 0;
+    };
+
+private:
+    // Locations the queue sends, looked up once per program
+    struct Program {
+        GLuint program;
+        GLint transforms, normalMatrices, tex0, tex1;
+    };
+
+    // Bits of the small ids packed into the keys, larger ids share the last value
+    // Mesh and texture ids are numbered again on every flush, so they stay small as assets are reloaded
+    static const int PROGRAM_BITS = 7;
+    static const int MESH_BITS = 14;
+    static const int TEXTURE_BITS = 12;
+    static const int TRANSPARENT_TEXTURE_BITS = 11;
+
+    std::vector<Item> items;
+    std::vector<uint32_t> itemPrograms;
+    std::vector<uint64_t> keys, sortedKeys;
+    std::vector<uint32_t> order, sortedOrder;
+
+    std::vector<Program> programs;
+    std::unordered_map<GLuint, uint32_t> programIds;
+    // Distinct meshes and textures of the flushed items, sorted so that an id is the index of its value
+    std::vector<uint64_t> meshValues;
+    std::vector<GLuint> textureValues;
+
+    std::vector<glm::mat4> instanceTransforms;
+    std::vector<glm::mat3> instanceNormalMatrices;
+    Stats stats;
+
+    /* Sorts values and drops duplicates, the vectors keep their capacity between flushes */
+    template<typename K>
+    static void makeIds(std::vector<K>& values) {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+    }
+
+    /* Returns the id of a value numbered by makeIds(), clamped to the key bits */
+    template<typename K>
+    static uint32_t getId(const std::vector<K>& values, K value, int bits) {
+        uint32_t id = (uint32_t)(std::lower_bound(values.begin(), values.end(), value) - values.begin());
+        return std::min(id, (1u << bits) - 1);
+    }
+
+    /* Returns the value identifying the mesh of an item, its vertex array and submesh offset */
+    static uint64_t getMeshValue(const Item& item) {
+        return (uint64_t)item.vertexArray << 32 | (uint32_t)item.indexOffset;
+    }
+
+    /* Returns the id of a program, looking up its locations the first time */
+    uint32_t getProgramId(ShaderManager& shader) {
+        static constexpr ShaderManager::Uniform<glm::mat4> transformsUniform("transforms");
+        static constexpr ShaderManager::Uniform<glm::mat3> normalMatricesUniform("normalMatrices");
+        static constexpr ShaderManager::Uniform<int> tex0Uniform("tex0");
+        static constexpr ShaderManager::Uniform<int> tex1Uniform("tex1");
+
+        std::unordered_map<GLuint, uint32_t>::iterator found = programIds.find(shader.getShaderProgram());
+        if (found != programIds.end())
+            return found->second;
+
+        Program program;
+        program.program = shader.getShaderProgram();
+        program.transforms = shader.getUniformLoc(transformsUniform);
+        program.normalMatrices = shader.getUniformLoc(normalMatricesUniform);
+        program.tex0 = shader.getUniformLoc(tex0Uniform);
+        program.tex1 = shader.getUniformLoc(tex1Uniform);
+        programs.push_back(program);
+        programIds[program.program] = (uint32_t)programs.size() - 1;
+        return (uint32_t)programs.size() - 1;
+    }
+
+    /* Returns the bits of a distance, which order like the distance as it is not negative */
+    static uint32_t getDistanceBits(float distance) {
+        distance = std::max(distance, 0.f);
+        uint32_t bits;
+        std::memcpy(&bits, &distance, sizeof(bits));
+        return bits;
+    }
+
+    /* Packs the sort key of an item
+    *  Opaque:      0 | program 7 | exponent 8 | mesh 14 | texture 12 | mantissa 22
+    *  Transparent: 1 | inverted distance 31 | program 7 | mesh 14 | texture 11
+    */
+    uint64_t makeKey(const Item& item, uint32_t program) {
+        uint32_t mesh = getId(meshValues, getMeshValue(item), MESH_BITS);
+        uint32_t distance = getDistanceBits(item.distance);
+
+        if (item.transparent) {
+            uint32_t texture = getId(textureValues, item.texture, TRANSPARENT_TEXTURE_BITS);
+            return (uint64_t)1 << 63 | (uint64_t)(~distance & 0x7FFFFFFFu) << 32 |
+                (uint64_t)std::min(program, (1u << PROGRAM_BITS) - 1) << 25 | (uint64_t)mesh << 11 | texture;
+        }
+
+        uint32_t texture = getId(textureValues, item.texture, TEXTURE_BITS);
+        return (uint64_t)std::min(program, (1u << PROGRAM_BITS) - 1) << 56 | (uint64_t)(distance >> 23 & 0xFF) << 48 |
+            (uint64_t)mesh << 34 | (uint64_t)texture << 22 | (distance >> 1 & 0x3FFFFF);
+    }
+
+    /* Sorts the item order by key, least significant byte first, skipping bytes all keys share */
+    void sortKeys() {
+        size_t count = keys.size();
+        order.resize(count);
+        for (size_t i = 0; i < count; i++)
+            order[i] = (uint32_t)i;
+        sortedKeys.resize(count);
+        sortedOrder.resize(count);
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t histogram[256] = {};
+            for (size_t i = 0; i < count; i++)
+                histogram[keys[i] >> shift & 0xFF]++;
+            if (histogram[keys[0] >> shift & 0xFF] == count)
+                continue;
+
+            size_t start = 0;
+            for (int digit = 0; digit < 256; digit++) {
+                size_t digitCount = histogram[digit];
+                histogram[digit] = start;
+                start += digitCount;
+            }
+            for (size_t i = 0; i < count; i++) {
+                size_t target = histogram[keys[i] >> shift & 0xFF]++;
+                sortedKeys[target] = keys[i];
+                sortedOrder[target] = order[i];
+            }
+            keys.swap(sortedKeys);
+            order.swap(sortedOrder);
+        }
+    }
+
+    /* Returns true if two items can be drawn by one instanced call */
+    static bool canMerge(const Item& a, const Item& b) {
+        return a.shader->getShaderProgram() == b.shader->getShaderProgram() && a.vertexArray == b.vertexArray &&
+            a.indexOffset == b.indexOffset && a.indexCount == b.indexCount && a.indexType == b.indexType &&
+            a.texture == b.texture && a.normalTexture == b.normalTexture && a.transparent == b.transparent &&
+            a.packed == b.packed && a.positionMin == b.positionMin && a.positionExtent == b.positionExtent;
+    }
+
+public:
+    RenderQueue() {}
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+
+    /* Queues a draw until the next flush */
+    void add(const Item& item) {
+        items.push_back(item);
+    }
+
+    /* Sorts and draws the queued items, then empties the queue
+    *  Programs must have their per-pass uniforms set, the queue only sends transforms and sampler units.
+    *  @param opaqueOnly (optional) - draw the opaque items and keep the transparent ones for the next flush,
+    *       so draws such as the sky can go between them
+    */
+    void flush(bool opaqueOnly = false) {
+        if (items.empty())
+            return;
+        GLState& state = GLState::getCurrent();
+        size_t issuedBefore = state.getCounts().issued;
+
+        std::chrono::steady_clock::time_point sortStart = std::chrono::steady_clock::now();
+        meshValues.clear();
+        textureValues.clear();
+        for (const Item& item : items) {
+            meshValues.push_back(getMeshValue(item));
+            textureValues.push_back(item.texture);
+        }
+        makeIds(meshValues);
+        makeIds(textureValues);
+
+        keys.resize(items.size());
+        itemPrograms.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            itemPrograms[i] = getProgramId(*items[i].shader);
+            keys[i] = makeKey(items[i], itemPrograms[i]);
+        }
+        sortKeys();
+        stats.sortMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count();
+
+        // Transparent keys have the top bit set, so they follow every opaque one
+        size_t count = order.size();
+        if (opaqueOnly)
+            count = std::lower_bound(keys.begin(), keys.end(), (uint64_t)1 << 63) - keys.begin();
+        for (size_t i = 0; i < count;) {
+            const Item& first = items[order[i]];
+            const Program& program = programs[itemPrograms[order[i]]];
+
+            // Gather the run of items sharing the mesh, textures and program
+            instanceTransforms.clear();
+            instanceNormalMatrices.clear();
+            size_t end = i;
+            while (end < count && instanceTransforms.size() < MAX_INSTANCES && canMerge(first, items[order[end]])) {
+                instanceTransforms.push_back(items[order[end]].transform);
+                instanceNormalMatrices.push_back(items[order[end++]].normalMatrix);
+            }
+
+            // Binds and values that match the tracked state are skipped
+            state.useProgram(program.program);
+            state.setBlend(first.transparent);
+            state.setDepthMask(first.transparent ? GL_FALSE : GL_TRUE);
+            state.bindVertexArray(first.vertexArray);
+            if (first.normalTexture != 0 && program.tex1 >= 0) {
+                state.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, first.normalTexture);
+                if (state.setUniform(program.tex1, 1))
+                    ShaderManager::getCallCounts().uploads++;
+            }
+            state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, first.texture);
+            if (state.setUniform(program.tex0, 0))
+                ShaderManager::getCallCounts().uploads++;
+
+            if (first.packed) {
+                glVertexAttrib3fv(5, glm::value_ptr(first.positionMin));
+                glVertexAttrib3fv(6, glm::value_ptr(first.positionExtent));
+            }
+
+            glUniformMatrix4fv(program.transforms, (GLsizei)instanceTransforms.size(), GL_FALSE,
+                glm::value_ptr(instanceTransforms[0]));
+            ShaderManager::getCallCounts().uploads++;
+            if (program.normalMatrices >= 0) {
+                glUniformMatrix3fv(program.normalMatrices, (GLsizei)instanceNormalMatrices.size(), GL_FALSE,
+                    glm::value_ptr(instanceNormalMatrices[0]));
+                ShaderManager::getCallCounts().uploads++;
+            }
+            glDrawElementsInstanced(GL_TRIANGLES, first.indexCount, first.indexType, (void*)first.indexOffset,
+                (GLsizei)instanceTransforms.size());
+            stats.drawCalls++;
+            i = end;
+        }
+
+        // Leave the defaults other draws expect
+        state.setBlend(false);
+        state.setDepthMask(GL_TRUE);
+
+        stats.items += count;
+        stats.stateChanges += state.getCounts().issued - issuedBefore;
+        if (opaqueOnly)
+            items.erase(std::remove_if(items.begin(), items.end(), [](const Item& item) {
+                return !item.transparent;
+            }), items.end());
+        else
+            items.clear();
+    }
+
+    /* Getters */
+    Stats& getStats() {
+        return stats;
+    }
+};
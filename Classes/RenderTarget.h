@@ -0,0 +1,164 @@
+#pragma once
+/* Offscreen framebuffer the scene is drawn into, and the depth convention every draw follows
+*  Reversed depth maps the near plane to 1 and infinity to 0 in a floating-point depth buffer,
+*  so the float exponent keeps precision far from the camera where the perspective divide loses
+*  it, and projections can drop the far plane. glClipControl makes clip depth 0 to 1 where the
+*  context has it, otherwise the reversal is applied over -1 to 1 and loses some precision
+*  near the camera. Cameras keep -1 to 1 projections for culling and picking, remapProjection()
+*  converts them for drawing. Frames are blitted to the framebuffer bound at init, the window
+*  one unless something else was bound. GL thread only.
+*/
+class RenderTarget {
+public:
+    /* How clip depth maps to the depth buffer */
+    enum Convention {
+        // Near -1 and far 1, cleared to 1 and tested with GL_LESS
+        STANDARD,
+        // Near 1 and far -1, cleared to 0 and tested with GL_GREATER
+        REVERSED,
+        // Near 1 and far 0 through glClipControl, cleared to 0 and tested with GL_GREATER
+        REVERSED_ZERO_TO_ONE
+    };
+
+private:
+    GLFramebuffer framebuffer;
+    GLRenderbuffer colorBuffer, depthBuffer;
+    // Framebuffer bound at init, frames are presented to it
+    GLuint presentFramebuffer = 0;
+    GLsizei width = 0, height = 0;
+
+    static Convention& current() {
+        static Convention convention = STANDARD;
+        return convention;
+    }
+
+public:
+    RenderTarget() {}
+    RenderTarget(const RenderTarget&) = delete;
+    RenderTarget& operator=(const RenderTarget&) = delete;
+
+    /* Returns the convention of the context, STANDARD unless init() reversed it */
+    static Convention getConvention() {
+        return current();
+    }
+    static bool isReversed() {
+        return current() != STANDARD;
+    }
+
+    /* Returns the value the depth buffer is cleared to, the far end */
+    static double getClearDepth() {
+        return isReversed() ? 0.0 : 1.0;
+    }
+
+    /* Returns the depth test that passes nearer fragments */
+    static GLenum getDepthFunc() {
+        return isReversed() ? GL_GREATER : GL_LESS;
+    }
+
+    /* Returns the depth test that also passes fragments at the far end, for draws there such as the sky */
+    static GLenum getFarDepthFunc() {
+        return isReversed() ? GL_GEQUAL : GL_LEQUAL;
+    }
+
+    /* Returns the normalized device depth of the far end */
+    static float getFarDepth() {
+        switch (current()) {
+            case REVERSED:
+                return -1.f;
+            case REVERSED_ZERO_TO_ONE:
+                return 0.f;
+            default:
+                return 1.f;
+        }
+    }
+
+    /* Converts a projection with -1 to 1 depth to the convention of the context
+    *  An infinite perspective comes out exact, near / distance with glClipControl.
+    */
+    static glm::mat4 remapProjection(const glm::mat4& projection) {
+        glm::mat4 remap = glm::mat4(1.f);
+        if (current() == REVERSED)
+            remap[2][2] = -1.f;
+        else if (current() == REVERSED_ZERO_TO_ONE) {
+            // Depth becomes (w - z) / 2
+            remap[2][2] = -.5f;
+            remap[3][2] = .5f;
+        }
+        else
+            return projection;
+        return remap * projection;
+    }
+
+    /* Sets the depth convention and creates the framebuffer, call on the GL thread before any camera is used
+    *  @param width, height - size of the framebuffer frames are presented to
+    *  @param reversed - draw with reversed floating-point depth, off draws straight to the bound framebuffer
+    *  @returns true if reversed depth is in use
+    */
+    bool init(int width, int height, bool reversed) {
+        GLint bound = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &bound);
+        presentFramebuffer = (GLuint)bound;
+        this->width = width;
+        this->height = height;
+        current() = STANDARD;
+        if (!reversed)
+            return false;
+
+        colorBuffer = GLRenderbuffer::generate();
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer.get());
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        depthBuffer = GLRenderbuffer::generate();
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer.get());
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        framebuffer = GLFramebuffer::generate();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.get());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer.get());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer.get());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Floating-point depth framebuffer incomplete, drawing with standard depth" << std::endl;
+            cleanup();
+            return false;
+        }
+
+        if (GLAD_GL_VERSION_4_5 || GLAD_GL_ARB_clip_control) {
+            glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+            current() = REVERSED_ZERO_TO_ONE;
+        }
+        else
+            current() = REVERSED;
+        glClearDepth(getClearDepth());
+        return true;
+    }
+
+    /* Binds the framebuffer to draw the next frame into, clear it afterwards */
+    void bind() {
+        if (framebuffer.get() != 0)
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.get());
+    }
+
+    /* Copies the frame to the framebuffer it is presented from, call before swapping */
+    void present() {
+        if (framebuffer.get() == 0)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.get());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, presentFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+    /* Deletion of the framebuffer after use, draws go to the presented framebuffer again */
+    void cleanup() {
+        if (framebuffer.get() != 0)
+            glBindFramebuffer(GL_FRAMEBUFFER, presentFramebuffer);
+        framebuffer.reset();
+        colorBuffer.reset();
+        depthBuffer.reset();
+    }
+
+    /* Getters */
+    static const char* getConventionName() {
+        static const char* names[3] = { "standard", "reversed", "reversed 0 to 1" };
+        return names[current()];
+    }
+};
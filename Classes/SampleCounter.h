@@ -0,0 +1,90 @@
+#pragma once
+/* Counts the samples that pass the depth test in a span of draws with occlusion queries
+*  Without multisampling that is the fragments shaded. Queries of the last few frames are
+*  kept in flight and read once their results are available, so counting never waits for
+*  the GPU unless every query is still pending. Each span is counted under a tag, such as
+*  the camera view, and the totals of a tag are kept until the stats are reset.
+*  GL thread only.
+*/
+class SampleCounter {
+public:
+    static const int MAX_TAGS = 4;
+
+    /* Spans counted since the stats were last reset */
+    struct Stats {
+        size_t spans = 0;
+        uint64_t samples = 0;
+    };
+
+private:
+    // Queries in flight, about one per frame
+    static const int QUERY_COUNT = 4;
+
+    GLQuery queries[QUERY_COUNT];
+    int tags[QUERY_COUNT] = {};
+    bool pending[QUERY_COUNT] = {};
+    int next = 0;
+    Stats stats[MAX_TAGS];
+
+    /* Adds the result of a pending query to its tag
+    *  @param wait - read the result even if the GPU has not finished, which stalls
+    */
+    void collect(int slot, bool wait) {
+        if (!pending[slot])
+            return;
+        if (!wait) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[slot].get(), GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+        GLuint64 samples = 0;
+        glGetQueryObjectui64v(queries[slot].get(), GL_QUERY_RESULT, &samples);
+        stats[tags[slot]].spans++;
+        stats[tags[slot]].samples += samples;
+        pending[slot] = false;
+    }
+
+public:
+    SampleCounter() {}
+    SampleCounter(const SampleCounter&) = delete;
+    SampleCounter& operator=(const SampleCounter&) = delete;
+
+    /* Creates the queries, call on the GL thread */
+    void initBuffers() {
+        for (int i = 0; i < QUERY_COUNT; i++)
+            queries[i] = GLQuery::generate();
+    }
+
+    /* Starts counting the draws that follow, spans must not nest
+    *  @param tag - totals to add the count to, below MAX_TAGS
+    */
+    void begin(int tag) {
+        for (int i = 0; i < QUERY_COUNT; i++)
+            collect(i, false);
+        // The oldest query is reused, waited for only if the GPU is that far behind
+        collect(next, true);
+        tags[next] = tag;
+        glBeginQuery(GL_SAMPLES_PASSED, queries[next].get());
+    }
+
+    /* Stops counting, the result is added once the GPU has it */
+    void end() {
+        glEndQuery(GL_SAMPLES_PASSED);
+        pending[next] = true;
+        next = (next + 1) % QUERY_COUNT;
+    }
+
+    /* Deletion of queries after use, pending results are dropped */
+    void cleanup() {
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            queries[i].reset();
+            pending[i] = false;
+        }
+    }
+
+    /* Getters */
+    Stats& getStats(int tag) {
+        return stats[tag];
+    }
+};
@@ -0,0 +1,476 @@
+#pragma once
+/* Bounding volume hierarchy over the world boxes of scene objects
+*  Built top-down with the surface area heuristic over binned centroids.
+*  Moving an object only refits the boxes on the path from its leaf to the
+*  root, and the tree is rebuilt once refits make it REBUILD_COST_RATIO times
+*  as expensive to traverse as when it was built. Frustum, ray and sphere
+*  queries then visit a number of nodes logarithmic in the object count for
+*  spread out scenes. Ids from insert() stay valid until removed, inserts and
+*  removals take effect at the next refit().
+*/
+class SceneBVH {
+public:
+    static const int MAX_LEAF_OBJECTS = 4;
+    static const int BIN_COUNT = 12;
+    // Refitted tree cost relative to the built one that triggers a rebuild
+    static constexpr float REBUILD_COST_RATIO = 1.5f;
+
+    /* Work done since the stats were last reset */
+    struct Stats {
+        size_t queries = 0;
+        size_t nodesVisited = 0;
+        size_t objectsTested = 0;
+        size_t refits = 0;
+        size_t rebuilds = 0;
+    };
+
+private:
+    struct Object {
+        glm::vec3 min, max;
+        // Leaf holding the object, -1 until the next build
+        int leaf;
+        bool alive;
+    };
+
+    struct Node {
+        glm::vec3 min, max;
+        int parent;
+        // Children of interior nodes
+        int left, right;
+        // Range in leafObjects, count is 0 for interior nodes
+        int first, count;
+    };
+
+    std::vector<Object> objects;
+    std::vector<Node> nodes;
+    std::vector<int> leafObjects;
+    std::vector<int> dirtyLeaves;
+    std::vector<int> stack;
+    std::vector<glm::vec3> centroids;
+    bool needsBuild = false;
+
+    // Surface area cost of the tree divided by the root area, now and after the last build
+    float cost = 0.f;
+    float builtCost = 0.f;
+    Stats stats;
+
+    static float getArea(glm::vec3 boxMin, glm::vec3 boxMax) {
+        glm::vec3 size = glm::max(boxMax - boxMin, glm::vec3(0.f));
+        return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    /* Returns the traversal cost a node adds, leaves are charged for each of their objects */
+    static float getNodeCost(const Node& node) {
+        return getArea(node.min, node.max) * (node.count > 0 ? (float)node.count : 1.f);
+    }
+
+    /* Returns the distance along a ray where it enters a box, FLT_MAX if it misses */
+    static float intersectRay(glm::vec3 origin, glm::vec3 inverseDirection, glm::vec3 boxMin, glm::vec3 boxMax) {
+        glm::vec3 t1 = (boxMin - origin) * inverseDirection;
+        glm::vec3 t2 = (boxMax - origin) * inverseDirection;
+        glm::vec3 slabEnter = glm::min(t1, t2);
+        glm::vec3 slabExit = glm::max(t1, t2);
+        float enter = std::max(std::max(slabEnter.x, slabEnter.y), std::max(slabEnter.z, 0.f));
+        float exit = std::min(std::min(slabExit.x, slabExit.y), slabExit.z);
+        return enter <= exit ? enter : FLT_MAX;
+    }
+
+    /* Returns true if a sphere touches a box */
+    static bool touchesSphere(glm::vec3 center, float radius, glm::vec3 boxMin, glm::vec3 boxMax) {
+        glm::vec3 closest = glm::clamp(center, boxMin, boxMax);
+        glm::vec3 offset = center - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+
+    /* Builds the subtree over a range of leafObjects, returns its node */
+    int buildNode(int parent, int first, int count) {
+        int index = (int)nodes.size();
+        nodes.push_back(Node());
+
+        glm::vec3 boxMin = glm::vec3(FLT_MAX), boxMax = glm::vec3(-FLT_MAX);
+        glm::vec3 centroidMin = glm::vec3(FLT_MAX), centroidMax = glm::vec3(-FLT_MAX);
+        for (int i = first; i < first + count; i++) {
+            const Object& object = objects[leafObjects[i]];
+            boxMin = glm::min(boxMin, object.min);
+            boxMax = glm::max(boxMax, object.max);
+            centroidMin = glm::min(centroidMin, centroids[leafObjects[i]]);
+            centroidMax = glm::max(centroidMax, centroids[leafObjects[i]]);
+        }
+        nodes[index].min = boxMin;
+        nodes[index].max = boxMax;
+        nodes[index].parent = parent;
+        nodes[index].left = nodes[index].right = -1;
+        nodes[index].first = first;
+        nodes[index].count = 0;
+
+        if (count <= MAX_LEAF_OBJECTS) {
+            nodes[index].count = count;
+            for (int i = first; i < first + count; i++)
+                objects[leafObjects[i]].leaf = index;
+            return index;
+        }
+
+        // Split along the axis the centroids spread furthest on
+        glm::vec3 extent = centroidMax - centroidMin;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        int* begin = leafObjects.data() + first;
+        int* end = begin + count;
+        int* middle = begin + count / 2;
+
+        if (extent[axis] > 0.f) {
+            // Bin centroids and sweep for the split with the lowest surface area cost
+            int binCounts[BIN_COUNT] = {};
+            glm::vec3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+            std::fill(binMin, binMin + BIN_COUNT, glm::vec3(FLT_MAX));
+            std::fill(binMax, binMax + BIN_COUNT, glm::vec3(-FLT_MAX));
+            float scale = BIN_COUNT / extent[axis];
+            auto getBin = [&](int object) {
+                return std::min((int)((centroids[object][axis] - centroidMin[axis]) * scale), BIN_COUNT - 1);
+            };
+            for (int* i = begin; i < end; i++) {
+                int bin = getBin(*i);
+                binCounts[bin]++;
+                binMin[bin] = glm::min(binMin[bin], objects[*i].min);
+                binMax[bin] = glm::max(binMax[bin], objects[*i].max);
+            }
+
+            // Cost of everything right of each split, then sweep from the left
+            float rightCost[BIN_COUNT];
+            glm::vec3 sweepMin = glm::vec3(FLT_MAX), sweepMax = glm::vec3(-FLT_MAX);
+            int sweepCount = 0;
+            for (int bin = BIN_COUNT - 1; bin > 0; bin--) {
+                sweepMin = glm::min(sweepMin, binMin[bin]);
+                sweepMax = glm::max(sweepMax, binMax[bin]);
+                sweepCount += binCounts[bin];
+                rightCost[bin] = sweepCount > 0 ? getArea(sweepMin, sweepMax) * sweepCount : 0.f;
+            }
+            float bestCost = FLT_MAX;
+            int bestSplit = -1;
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (int split = 1; split < BIN_COUNT; split++) {
+                sweepMin = glm::min(sweepMin, binMin[split - 1]);
+                sweepMax = glm::max(sweepMax, binMax[split - 1]);
+                sweepCount += binCounts[split - 1];
+                if (sweepCount == 0 || sweepCount == count)
+                    continue;
+                float splitCost = getArea(sweepMin, sweepMax) * sweepCount + rightCost[split];
+                if (splitCost < bestCost) {
+                    bestCost = splitCost;
+                    bestSplit = split;
+                }
+            }
+            if (bestSplit > 0)
+                middle = std::partition(begin, end, [&](int object) { return getBin(object) < bestSplit; });
+        }
+
+        // Equal centroids or one sided bins, split by count
+        if (middle == begin || middle == end) {
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [&](int a, int b) {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+        }
+
+        int leftCount = (int)(middle - begin);
+        int left = buildNode(index, first, leftCount);
+        int right = buildNode(index, first + leftCount, count - leftCount);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+
+    /* Returns the cost of the whole tree divided by the root area */
+    float computeCost() {
+        float total = 0.f;
+        for (const Node& node : nodes)
+            total += getNodeCost(node);
+        float rootArea = getArea(nodes[0].min, nodes[0].max);
+        return rootArea > 0.f ? total / rootArea : 0.f;
+    }
+
+    /* Recomputes boxes from a leaf upwards until one does not change */
+    void refitPath(int index) {
+        float rootArea = getArea(nodes[0].min, nodes[0].max);
+        float total = cost * rootArea;
+        while (index >= 0) {
+            Node& node = nodes[index];
+            glm::vec3 boxMin = glm::vec3(FLT_MAX), boxMax = glm::vec3(-FLT_MAX);
+            if (node.count > 0)
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    boxMin = glm::min(boxMin, objects[leafObjects[i]].min);
+                    boxMax = glm::max(boxMax, objects[leafObjects[i]].max);
+                }
+            else {
+                boxMin = glm::min(nodes[node.left].min, nodes[node.right].min);
+                boxMax = glm::max(nodes[node.left].max, nodes[node.right].max);
+            }
+            if (boxMin == node.min && boxMax == node.max)
+                break;
+
+            total -= getNodeCost(node);
+            node.min = boxMin;
+            node.max = boxMax;
+            total += getNodeCost(node);
+            index = node.parent;
+        }
+        rootArea = getArea(nodes[0].min, nodes[0].max);
+        cost = rootArea > 0.f ? total / rootArea : 0.f;
+    }
+
+    /* Appends the alive objects under a node */
+    void appendSubtree(int index, std::vector<int>& results) {
+        size_t base = stack.size();
+        stack.push_back(index);
+        while (stack.size() > base) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            stats.nodesVisited++;
+            if (node.count == 0) {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count; i++)
+                if (objects[leafObjects[i]].alive)
+                    results.push_back(leafObjects[i]);
+        }
+    }
+
+public:
+    SceneBVH() {}
+
+    /* Adds an object by its world box
+    *  @returns id of the object
+    */
+    int insert(glm::vec3 boxMin, glm::vec3 boxMax) {
+        Object object = { boxMin, boxMax, -1, true };
+        objects.push_back(object);
+        needsBuild = true;
+        return (int)objects.size() - 1;
+    }
+
+    /* Removes an object, its id is not reused */
+    void remove(int id) {
+        objects[id].alive = false;
+        needsBuild = true;
+    }
+
+    /* Moves the box of an object, the tree follows at the next refit */
+    void update(int id, glm::vec3 boxMin, glm::vec3 boxMax) {
+        Object& object = objects[id];
+        object.min = boxMin;
+        object.max = boxMax;
+        if (!needsBuild && object.leaf >= 0)
+            dirtyLeaves.push_back(object.leaf);
+    }
+
+    /* Rebuilds the whole tree from the alive objects */
+    void build() {
+        nodes.clear();
+        leafObjects.clear();
+        dirtyLeaves.clear();
+        centroids.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); i++) {
+            objects[i].leaf = -1;
+            centroids[i] = (objects[i].min + objects[i].max) * 0.5f;
+            if (objects[i].alive)
+                leafObjects.push_back((int)i);
+        }
+        needsBuild = false;
+        stats.rebuilds++;
+        if (leafObjects.empty()) {
+            cost = builtCost = 0.f;
+            return;
+        }
+
+        nodes.reserve(leafObjects.size() * 2 / MAX_LEAF_OBJECTS + 1);
+        buildNode(-1, 0, (int)leafObjects.size());
+        cost = builtCost = computeCost();
+    }
+
+    /* Applies inserts, removals and moves since the last call, call once per frame before querying */
+    void refit() {
+        if (needsBuild) {
+            build();
+            return;
+        }
+        if (dirtyLeaves.empty())
+            return;
+
+        for (int leaf : dirtyLeaves)
+            refitPath(leaf);
+        dirtyLeaves.clear();
+        stats.refits++;
+
+        // Moves far from the build positions leave large overlapping boxes
+        if (cost > builtCost * REBUILD_COST_RATIO)
+            build();
+    }
+
+    /* Collects the objects whose boxes may be visible
+    *  @param culler - frustum of the camera
+    *  @param visible - receives the object ids
+    */
+    void cullFrustum(const FrustumCuller& culler, std::vector<int>& visible) {
+        visible.clear();
+        stats.queries++;
+        if (nodes.empty())
+            return;
+
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            stats.nodesVisited++;
+
+            // Subtrees fully inside need no more tests
+            FrustumCuller::Containment containment = culler.classifyBox(node.min, node.max);
+            if (containment == FrustumCuller::OUTSIDE)
+                continue;
+            if (containment == FrustumCuller::INSIDE) {
+                appendSubtree(index, visible);
+                continue;
+            }
+
+            if (node.count == 0) {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const Object& object = objects[leafObjects[i]];
+                stats.objectsTested++;
+                if (object.alive && culler.classifyBox(object.min, object.max) != FrustumCuller::OUTSIDE)
+                    visible.push_back(leafObjects[i]);
+            }
+        }
+    }
+
+    /* Finds the nearest object box a ray enters
+    *  @param origin - start of the ray
+    *  @param direction - direction of the ray, distances are in its length
+    *  @param maxDistance - boxes entered further are ignored
+    *  @param hitDistance (optional) - receives the distance to the hit
+    *  @returns id of the object hit, -1 if none
+    */
+    int raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, float* hitDistance = nullptr) {
+        stats.queries++;
+        int hit = -1;
+        float nearest = maxDistance;
+        if (nodes.empty())
+            return hit;
+
+        glm::vec3 inverseDirection = 1.f / direction;
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            stats.nodesVisited++;
+            if (intersectRay(origin, inverseDirection, node.min, node.max) > nearest)
+                continue;
+
+            if (node.count == 0) {
+                // Visit the nearer child first, it may rule out the other
+                float leftDistance = intersectRay(origin, inverseDirection, nodes[node.left].min, nodes[node.left].max);
+                float rightDistance = intersectRay(origin, inverseDirection, nodes[node.right].min, nodes[node.right].max);
+                int nearChild = leftDistance <= rightDistance ? node.left : node.right;
+                int farChild = leftDistance <= rightDistance ? node.right : node.left;
+                if (std::max(leftDistance, rightDistance) <= nearest)
+                    stack.push_back(farChild);
+                if (std::min(leftDistance, rightDistance) <= nearest)
+                    stack.push_back(nearChild);
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const Object& object = objects[leafObjects[i]];
+                stats.objectsTested++;
+                if (!object.alive)
+                    continue;
+                float distance = intersectRay(origin, inverseDirection, object.min, object.max);
+                if (distance <= nearest) {
+                    nearest = distance;
+                    hit = leafObjects[i];
+                }
+            }
+        }
+        if (hit >= 0 && hitDistance)
+            *hitDistance = nearest;
+        return hit;
+    }
+
+    /* Collects the objects whose boxes touch a sphere
+    *  @param center - center of the sphere
+    *  @param radius - radius of the sphere
+    *  @param results - receives the object ids
+    */
+    void querySphere(glm::vec3 center, float radius, std::vector<int>& results) {
+        results.clear();
+        stats.queries++;
+        if (nodes.empty())
+            return;
+
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            stats.nodesVisited++;
+            if (!touchesSphere(center, radius, node.min, node.max))
+                continue;
+
+            if (node.count == 0) {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+                continue;
+            }
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const Object& object = objects[leafObjects[i]];
+                stats.objectsTested++;
+                if (object.alive && touchesSphere(center, radius, object.min, object.max))
+                    results.push_back(leafObjects[i]);
+            }
+        }
+    }
+
+    /* Returns the world box around a transformed box
+    *  @param transform - model matrix
+    *  @param boxMin, boxMax - box before the transform
+    *  @param worldMin, worldMax - receive the transformed box
+    */
+    static void transformBox(const glm::mat4& transform, glm::vec3 boxMin, glm::vec3 boxMax,
+        glm::vec3& worldMin, glm::vec3& worldMax)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4((boxMin + boxMax) * 0.5f, 1.f));
+        glm::vec3 halfSize = (boxMax - boxMin) * 0.5f;
+
+        // Each world axis spans the absolute projections of the local half sizes
+        glm::vec3 extent = glm::vec3(0);
+        for (int column = 0; column < 3; column++)
+            extent += glm::abs(glm::vec3(transform[column])) * halfSize[column];
+        worldMin = center - extent;
+        worldMax = center + extent;
+    }
+
+    /* Getters */
+    size_t getObjectCount() {
+        return objects.size();
+    }
+    size_t getNodeCount() {
+        return nodes.size();
+    }
+    float getCost() {
+        return cost;
+    }
+    void getObjectBounds(int id, glm::vec3& boxMin, glm::vec3& boxMax) {
+        boxMin = objects[id].min;
+        boxMax = objects[id].max;
+    }
+    Stats& getStats() {
+        return stats;
+    }
+};
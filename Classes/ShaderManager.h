@@ -2,19 +2,188 @@
 /* Loads shader files and creates shader
 *  Vertex and fragment file must have the same name,
 *  and saved in "./Shaders/"
+*  Optional defines are inserted after the #version line of both files
+*  to compile variants of the same shader. Sources baked into the mounted
+*  asset pack are read from it instead.
+*
+*  Active uniforms and uniform blocks are enumerated once after linking,
+*  uniforms are then sent through Uniform handles hashed at compile time and
+*  looked up in that table without asking the driver.
 */ 
 class ShaderManager {
+public:
+	/* Uniform name hashed at compile time, typed by the value it takes
+	*  Declare constexpr from a string literal, e.g.
+	*  constexpr ShaderManager::Uniform<glm::mat4> view("view");
+	*/
+	template <typename T>
+	struct Uniform {
+		const char* name;
+		uint32_t hash;
+		constexpr explicit Uniform(const char* name) : name(name), hash(hashName(name)) {}
+	};
+
+	/* Driver uniform calls made since the counts were last reset */
+	struct CallCounts {
+		size_t lookups = 0;	// glGetUniformLocation
+		size_t uploads = 0;	// glUniform*
+		size_t blockUpdates = 0;	// Uniform buffer uploads
+	};
+
+	// Fixed binding points of the uniform blocks shared by all programs, filled by FrameUniforms
+	static const GLuint FRAME_DATA_BINDING = 0;
+	static const GLuint LIGHTS_BINDING = 1;
+
+	/* FNV-1a hash of a uniform name */
+	static constexpr uint32_t hashName(const char* name) {
+		uint32_t hash = 2166136261u;
+		while (*name) {
+			hash ^= (unsigned char)*name++;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	/* Returns whether uniforms are sent through the location table,
+	*  when off every send asks the driver for the location by name
+	*/
+	static bool& cachedLocations() {
+		static bool enabled = true;
+		return enabled;
+	}
+
+	/* Returns driver uniform calls counted over all shaders and models */
+	static CallCounts& getCallCounts() {
+		static CallCounts counts;
+		return counts;
+	}
+
 private:
+	/* Active uniform or uniform block of the linked program */
+	struct Reflected {
+		uint32_t hash;
+		GLint location;		// Block index for uniform blocks
+		GLenum type;		// Uniforms only
+		GLint dataSize;		// Uniform blocks only, in bytes
+	};
+
 	GLuint vertexShader;
 	GLuint fragmentShader;
 	GLuint shaderProgram;
+	std::string defines;
+	// Sorted by hash, built once after linking
+	std::vector<Reflected> uniforms;
+	std::vector<Reflected> blocks;
+
+	/* Inserts defines after the #version line of a shader source */
+	std::string addDefines(std::string source) {
+		if (defines.empty())
+			return source;
+		size_t version = source.find("#version");
+		size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return defines + "\n" + source;
+		return source.substr(0, lineEnd + 1) + defines + "\n" + source.substr(lineEnd + 1);
+	}
 	
+	/* Reads shader source from the asset pack or its file */
+	static std::string readSource(std::string path) {
+		AssetPack::Asset asset;
+		if (AssetPack::getMounted().find(path, AssetPack::SHADER, asset))
+			return std::string((const char*)asset.data, (size_t)asset.entry->dataSize);
+
+		std::fstream src(path);
+		std::stringstream buff;
+		buff << src.rdbuf();
+		return buff.str();
+	}
+
+	/* Returns entry with the given hash in a sorted table, or null */
+	static const Reflected* find(const std::vector<Reflected>& table, uint32_t hash) {
+		std::vector<Reflected>::const_iterator found = std::lower_bound(table.begin(), table.end(), hash,
+			[](const Reflected& entry, uint32_t value) { return entry.hash < value; });
+		return found != table.end() && found->hash == hash ? &*found : nullptr;
+	}
+
+	/* Returns location of a uniform from the table, or from the driver if the table is off */
+	GLint findLocation(const char* varname, uint32_t hash) {
+		if (!cachedLocations()) {
+			getCallCounts().lookups++;
+			return glGetUniformLocation(shaderProgram, varname);
+		}
+		const Reflected* found = find(uniforms, hash);
+		return found ? found->location : -1;
+	}
+
+	/* Adds a table entry, reports names whose hashes collide */
+	static void addEntry(std::vector<Reflected>& table, std::vector<std::string>& names,
+		std::string entryName, GLint location, GLenum type, GLint dataSize)
+	{
+		uint32_t hash = hashName(entryName.c_str());
+		for (size_t i = 0; i < table.size(); i++)
+			if (table[i].hash == hash && names[i] != entryName)
+				std::cout << "Uniform hash collision: " << names[i] << ", " << entryName << std::endl;
+		Reflected entry = { hash, location, type, dataSize };
+		table.push_back(entry);
+		names.push_back(entryName);
+	}
+
+	/* Builds the tables of active uniforms and uniform blocks of the linked program */
+	void reflect() {
+		uniforms.clear();
+		blocks.clear();
+		std::vector<std::string> names;
+
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(std::max(maxLength, 1));
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(shaderProgram, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+			std::string uniformName(buffer.data(), length);
+
+			// Members of uniform blocks have no location
+			GLint location = glGetUniformLocation(shaderProgram, uniformName.c_str());
+			if (location < 0)
+				continue;
+			addEntry(uniforms, names, uniformName, location, type, 0);
+
+			// Arrays are reported as "name[0]", also accept "name"
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+				addEntry(uniforms, names, uniformName.substr(0, uniformName.size() - 3), location, type, 0);
+		}
+
+		names.clear();
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+		buffer.assign(std::max(maxLength, 1), 0);
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length = 0;
+			GLint dataSize = 0;
+			glGetActiveUniformBlockName(shaderProgram, (GLuint)i, (GLsizei)buffer.size(), &length, buffer.data());
+			glGetActiveUniformBlockiv(shaderProgram, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+			addEntry(blocks, names, std::string(buffer.data(), length), i, 0, dataSize);
+
+			// Shared blocks go to their fixed binding point, GLSL 3.30 cannot declare it
+			uint32_t hash = blocks.back().hash;
+			if (hash == hashName("FrameData"))
+				glUniformBlockBinding(shaderProgram, (GLuint)i, FRAME_DATA_BINDING);
+			else if (hash == hashName("Lights"))
+				glUniformBlockBinding(shaderProgram, (GLuint)i, LIGHTS_BINDING);
+		}
+
+		std::sort(uniforms.begin(), uniforms.end(),
+			[](const Reflected& a, const Reflected& b) { return a.hash < b.hash; });
+		std::sort(blocks.begin(), blocks.end(),
+			[](const Reflected& a, const Reflected& b) { return a.hash < b.hash; });
+	}
+
 	/* Creates vertex shader from the specified file */
 	void createVertexShader(std::string name) {
-		std::fstream vertSrc("Shaders/" + name + ".vert");
-		std::stringstream vertBuff;
-		vertBuff << vertSrc.rdbuf();
-		std::string vertString = vertBuff.str();
+		std::string vertString = addDefines(readSource("Shaders/" + name + ".vert"));
 		const char* v = vertString.c_str();
 
 		vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -24,10 +193,7 @@ private:
 
 	/* Creates fragment shader from the specified file */
 	void createFragmentShader(std::string name) {
-		std::fstream fragSrc("Shaders/" + name + ".frag");
-		std::stringstream fragBuff;
-		fragBuff << fragSrc.rdbuf();
-		std::string fragString = fragBuff.str();
+		std::string fragString = addDefines(readSource("Shaders/" + name + ".frag"));
 		const char* f = fragString.c_str();
 
 		fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -38,7 +204,11 @@ private:
 public:
 	ShaderManager() {}
 
-	ShaderManager(std::string name) {
+	/* @param name - file name of the shaders without extension
+	*  @param defines (optional) - preprocessor lines such as "#define PACKED_VERTICES"
+	*/
+	ShaderManager(std::string name, std::string defines = "") {
+		this->defines = defines;
 		createVertexShader(name);
 		createFragmentShader(name);
 
@@ -46,43 +216,93 @@ public:
 		glAttachShader(shaderProgram, vertexShader);
 		glAttachShader(shaderProgram, fragmentShader);
 		glLinkProgram(shaderProgram);
+		reflect();
 	}
 
 	/* Getters */
 	GLuint getShaderProgram() {
 		return shaderProgram;
 	}
-	unsigned int getUniformLoc(std::string varname) {
-		return glGetUniformLocation(shaderProgram, varname.c_str());
+	size_t getUniformCount() {
+		return uniforms.size();
+	}
+	size_t getBlockCount() {
+		return blocks.size();
+	}
+	GLint getUniformLoc(std::string varname) {
+		return findLocation(varname.c_str(), hashName(varname.c_str()));
+	}
+	template <typename T>
+	GLint getUniformLoc(Uniform<T> uniform) {
+		return findLocation(uniform.name, uniform.hash);
 	}
 
-	/* Sets managed shader to be active in program */
+	/* Returns index of an active uniform block, or GL_INVALID_INDEX */
+	GLuint getBlockIndex(const char* blockName) {
+		const Reflected* found = find(blocks, hashName(blockName));
+		return found ? (GLuint)found->location : GL_INVALID_INDEX;
+	}
+
+	/* Returns size of an active uniform block in bytes, or 0 */
+	GLint getBlockSize(const char* blockName) {
+		const Reflected* found = find(blocks, hashName(blockName));
+		return found ? found->dataSize : 0;
+	}
+
+	/* Sets managed shader to be active in program, skipped if it already is */
 	void useShaderProgram() {
-		glUseProgram(shaderProgram);
+		GLState::getCurrent().useProgram(shaderProgram);
+	}
+
+	/* Sends uniform values through handles, ints that did not change are skipped */
+	void send(Uniform<int> uniform, int value) {
+		if (GLState::getCurrent().setUniform(getUniformLoc(uniform), value))
+			getCallCounts().uploads++;
+	}
+	void send(Uniform<float> uniform, float value) {
+		glUniform1f(getUniformLoc(uniform), value);
+		getCallCounts().uploads++;
+	}
+	void send(Uniform<glm::vec3> uniform, const glm::vec3& value) {
+		glUniform3fv(getUniformLoc(uniform), 1, glm::value_ptr(value));
+		getCallCounts().uploads++;
+	}
+	void send(Uniform<glm::vec4> uniform, const glm::vec4& value) {
+		glUniform4fv(getUniformLoc(uniform), 1, glm::value_ptr(value));
+		getCallCounts().uploads++;
+	}
+	void send(Uniform<glm::mat4> uniform, const glm::mat4& value) {
+		glUniformMatrix4fv(getUniformLoc(uniform), 1, GL_FALSE, glm::value_ptr(value));
+		getCallCounts().uploads++;
 	}
 
 	/* Sends uniform int value */
-	void sendInt(std::string varname, float value) {
-		glUniform1i(glGetUniformLocation(shaderProgram, varname.c_str()), value);
+	void sendInt(std::string varname, int value) {
+		if (GLState::getCurrent().setUniform(getUniformLoc(varname), value))
+			getCallCounts().uploads++;
 	}
 
 	/* Sends uniform float value */
 	void sendFloat(std::string varname, float value) {
-		glUniform1f(glGetUniformLocation(shaderProgram, varname.c_str()), value);
+		glUniform1f(getUniformLoc(varname), value);
+		getCallCounts().uploads++;
 	}
 
 	/* Sends uniform vec3 value */
 	void sendVec3(std::string varname, glm::vec3 value) {
-		glUniform3fv(glGetUniformLocation(shaderProgram, varname.c_str()), 1, glm::value_ptr(value));
+		glUniform3fv(getUniformLoc(varname), 1, glm::value_ptr(value));
+		getCallCounts().uploads++;
 	}
 
 	/* Sends uniform vec4 value */
-	void sendVec4(std::string varname, glm::vec3 value) {
-		glUniform4fv(glGetUniformLocation(shaderProgram, varname.c_str()), 1, glm::value_ptr(value));
+	void sendVec4(std::string varname, glm::vec4 value) {
+		glUniform4fv(getUniformLoc(varname), 1, glm::value_ptr(value));
+		getCallCounts().uploads++;
 	}
 
 	/* Sends uniform mat4 value */
 	void sendMat4(std::string varname, glm::mat4 value) {
-		glUniformMatrix4fv(glGetUniformLocation(shaderProgram, varname.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+		glUniformMatrix4fv(getUniformLoc(varname), 1, GL_FALSE, glm::value_ptr(value));
+		getCallCounts().uploads++;
 	}
 };
\ No newline at end of file
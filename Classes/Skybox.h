@@ -1,9 +1,14 @@
 #pragma once
 class Skybox {
 private:
-    unsigned int VAO, VBO, EBO;
-    unsigned int tex;
+    GLVertexArray VAO;
+    GLBuffer VBO, EBO;
+    GLTexture tex;
+    // Id of the cubemap in the memory budget
+    int asset = -1;
     ShaderManager shader;
+    // Streams the faces after initBuffers(), a placeholder is drawn until they arrive
+    TextureStreamer* streamer = nullptr;
 
     glm::mat4 default_projection = glm::perspective(
         glm::radians(60.f),
@@ -43,24 +48,19 @@ private:
     };
     glm::vec4 filterColor;
 
-public:
-	Skybox() {
-        // Creates buffers
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+    // Decoded cubemap faces, freed after upload
+    Image faceImages[6];
 
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(defaultVertices), &defaultVertices, GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), (void*)0);
+public:
+    static const int FACE_COUNT = 6;
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GL_INT) * 36, &defaultIndices, GL_STATIC_DRAW);
+	Skybox() {
+        filterColor = glm::vec4(0.05, 0.1, .5, 0.5);
+	}
 
-        glEnableVertexAttribArray(0);
-        
-        std::string faces[]{
+    /* Returns file path of a cubemap face */
+    static std::string getFacePath(int face) {
+        static const std::string faces[FACE_COUNT]{
             "Skybox/uw_ft.jpg",
             "Skybox/uw_bk.jpg",
             "Skybox/uw_up.jpg",
@@ -68,9 +68,37 @@ public:
             "Skybox/uw_rt.jpg",
             "Skybox/uw_lf.jpg",
         };
+        return faces[face];
+    }
 
-        glGenTextures(1, &tex);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+    /* Decodes a cubemap face, faces can be decoded in parallel
+    *  @param face - index of face in +X, -X, +Y, -Y, +Z, -Z order
+    */
+    void loadFace(int face) {
+        faceImages[face].load(getFacePath(face), false);
+    }
+
+    /* Creates buffers, uploads decoded faces and creates shader, call on the GL thread
+    *  @param textureStreamer (optional) - streams the faces in over the next frames
+    */
+    void initBuffers(TextureStreamer* textureStreamer = nullptr) {
+        // Creates buffers
+        VAO = GLVertexArray::generate();
+        VBO = GLBuffer::generate();
+        EBO = GLBuffer::generate();
+
+        GLState::getCurrent().bindVertexArray(VAO.get());
+        glBindBuffer(GL_ARRAY_BUFFER, VBO.get());
+        glBufferData(GL_ARRAY_BUFFER, sizeof(defaultVertices), &defaultVertices, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), (void*)0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.get());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GL_INT) * 36, &defaultIndices, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+
+        tex = GLTexture::generate();
+        GLState::getCurrent().bindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, tex.get());
 
         // Prevent pixelating
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -81,37 +109,44 @@ public:
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        // Load skybox images
-        for (int i = 0; i < 6; i++) {
-            int w, h, skyCChannel;
-            stbi_set_flip_vertically_on_load(false);
-
-            unsigned char* data = stbi_load(faces[i].c_str(), &w, &h, &skyCChannel, 0);
-
-            if (data) {
+        // Upload decoded skybox images, drawn every frame so never evicted
+        streamer = textureStreamer;
+        size_t bytes = 0;
+        for (int i = 0; i < FACE_COUNT; i++)
+            bytes += faceImages[i].getSize();
+        asset = MemoryBudget::get().track("Skybox", MemoryBudget::CUBEMAPS, false);
+        MemoryBudget::get().setUsage(asset, 0, bytes);
+        for (int i = 0; i < FACE_COUNT; i++) {
+            if (streamer) {
+                streamer->queue(tex.get(), GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                    faceImages[i], GL_RGB, TextureStreamer::CUBE);
+                faceImages[i].release();
+            }
+            else if (faceImages[i].isLoaded()) {
                 glTexImage2D(
                     GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
                     0,
                     GL_RGB,
-                    w,
-                    h,
+                    faceImages[i].getWidth(),
+                    faceImages[i].getHeight(),
                     0,
-                    GL_RGB,
+                    faceImages[i].getFormat(),
                     GL_UNSIGNED_BYTE,
-                    data
+                    faceImages[i].getPixels()
                 );
+                if (const GLint* swizzle = faceImages[i].getSwizzle())
+                    glTexParameteriv(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
 
-                stbi_image_free(data);
+                faceImages[i].release();
             }
         }
 
-        stbi_set_flip_vertically_on_load(true);
-        
-        // Creates vertex and fragment shader for skybox
-        shader = ShaderManager("skybox");
-
-        filterColor = glm::vec4(0.05, 0.1, .5, 0.5);
-	}
+        // Creates vertex and fragment shader for skybox, the view comes from the FrameData block
+        // The sky is placed at the far end of the depth convention in use
+        shader = ShaderManager("skybox", "#define FAR_DEPTH " + std::to_string(RenderTarget::getFarDepth()));
+        shader.useShaderProgram();
+        shader.sendMat4("skyProjection", default_projection);
+    }
 
     /* Resets filter color to normal
     *  @param color (optional) - ovveride filter color to set
@@ -120,38 +155,38 @@ public:
         filterColor = color;
     }
 
-    /* Draws skybox
-    *  @param viewMatrix - view matrix of camera
+    /* Draws skybox with the camera of the FrameData block, at the far end of the depth range
+    *  Drawn after the opaque models, pixels they covered are rejected before the fragment shader runs.
     *  @param isFPP - used to flag the use of color filter
     */
-    void draw(glm::mat4 viewMatrix, int isFPP) {
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);
-
-        shader.useShaderProgram();
+    void draw(int isFPP) {
+        constexpr ShaderManager::Uniform<glm::vec4> filterColorUniform("filterColor");
+        constexpr ShaderManager::Uniform<int> isFPPUniform("isFPP");
 
-        glm::mat4 sky_view = glm::mat4(1.f);
-        sky_view = glm::mat4(glm::mat3(viewMatrix));
+        GLState& state = GLState::getCurrent();
+        state.setDepthMask(GL_FALSE);
+        state.setDepthFunc(RenderTarget::getFarDepthFunc());
 
-        shader.sendMat4("projection", default_projection);
-        shader.sendMat4("view", sky_view);
-        shader.sendVec4("filterColor", filterColor);
-        shader.sendInt("isFPP", isFPP);
+        shader.useShaderProgram();
+        shader.send(filterColorUniform, filterColor);
+        shader.send(isFPPUniform, isFPP);
 
-        glBindVertexArray(VAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, tex);
+        state.bindVertexArray(VAO.get());
+        state.bindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, streamer ? streamer->resolve(tex.get()) : tex.get());
 
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS);
+        state.setDepthMask(GL_TRUE);
+        state.setDepthFunc(RenderTarget::getDepthFunc());
     }
     
     /* Deletion of buffers after object use */
     void cleanup() {
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &EBO);
+        VAO.reset();
+        VBO.reset();
+        EBO.reset();
+        tex.reset();
+        MemoryBudget::get().untrack(asset);
+        asset = -1;
     }
 };
\ No newline at end of file
@@ -0,0 +1,293 @@
+#pragma once
+/* Generates smooth per-vertex tangent frames for welded meshes
+*  Each triangle's tangent and bitangent are derived from its positions and
+*  UVs, summed over the triangles around every vertex, then orthonormalized
+*  against the vertex normal. Triangles and vertices are processed in chunks
+*  on several threads, and four at a time with SSE where it is available.
+*
+*  Vertex layout: position, normal, uv, tangent, bitangent (14 floats), the
+*  tangent and bitangent are overwritten.
+*/
+class TangentGenerator {
+public:
+    // UV area below which a triangle has no usable tangent direction
+    static constexpr float DEGENERATE_UV = 1e-12f;
+
+    /* Returns true if the SSE path is compiled in */
+    static bool hasSimd() {
+#ifdef USE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* Overwrites tangents and bitangents of welded vertices
+    *  @param vertices - interleaved vertex data
+    *  @param vertexCount - number of vertices
+    *  @param offset - floats per vertex, at least 14
+    *  @param indices - triangle list
+    *  @param threadCount (optional) - number of threads to split the work over
+    *  @param useSimd (optional) - use SSE if compiled in, otherwise scalar code
+    */
+    static void generate(GLfloat* vertices, size_t vertexCount, int offset, const std::vector<GLuint>& indices,
+        unsigned int threadCount = std::thread::hardware_concurrency(), bool useSimd = true)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (vertexCount == 0)
+            return;
+#ifndef USE_SSE
+        useSimd = false;
+#endif
+
+        // Tangent and bitangent of every triangle, one array per component
+        std::vector<float> faces(triangleCount * 6);
+        Frames triangles = { faces.data(), triangleCount };
+        runChunks(triangleCount, threadCount, [&](size_t begin, size_t end) {
+#ifdef USE_SSE
+            if (useSimd) {
+                computeTrianglesSse(vertices, offset, indices.data(), triangles, begin, end);
+                return;
+            }
+#endif
+            computeTriangles(vertices, offset, indices.data(), triangles, begin, end);
+        });
+
+        // Triangles around each vertex, stored as offsets into one array
+        std::vector<size_t> adjacencyStart(vertexCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            adjacencyStart[indices[i] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyStart[v + 1] += adjacencyStart[v];
+        std::vector<GLuint> adjacency(triangleCount * 3);
+        std::vector<size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            adjacency[fill[indices[i]]++] = (GLuint)(i / 3);
+        fill.clear();
+        fill.shrink_to_fit();
+
+        // Sum around each vertex and orthonormalize, vertices only read their own triangles
+        std::vector<float> sums(vertexCount * 6);
+        Frames accumulated = { sums.data(), vertexCount };
+        runChunks(vertexCount, threadCount, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; v++) {
+                float sum[6] = {};
+                for (size_t a = adjacencyStart[v]; a < adjacencyStart[v + 1]; a++)
+                    for (int component = 0; component < 6; component++)
+                        sum[component] += triangles.get(component)[adjacency[a]];
+                for (int component = 0; component < 6; component++)
+                    accumulated.get(component)[v] = sum[component];
+            }
+#ifdef USE_SSE
+            if (useSimd) {
+                orthonormalizeSse(vertices, offset, accumulated, begin, end);
+                return;
+            }
+#endif
+            for (size_t v = begin; v < end; v++)
+                orthonormalize(vertices + v * offset, accumulated, v);
+        });
+    }
+
+private:
+    // Six component arrays (tangent xyz, bitangent xyz) of count entries in one block
+    struct Frames {
+        float* data;
+        size_t count;
+
+        float* get(int component) const {
+            return data + component * count;
+        }
+    };
+
+    /* Splits a range into chunks of multiples of four and runs them on separate threads
+    *  @param count - size of the range
+    *  @param threadCount - largest number of threads to use, including the calling one
+    *  @param task - callable taking the begin and end of a chunk
+    */
+    template <typename F>
+    static void runChunks(size_t count, unsigned int threadCount, F task) {
+        // Small ranges are not worth starting threads for
+        const size_t MIN_CHUNK = 4096;
+        size_t chunkCount = std::min<size_t>(std::max(threadCount, 1u), (count + MIN_CHUNK - 1) / MIN_CHUNK);
+        if (chunkCount <= 1) {
+            task((size_t)0, count);
+            return;
+        }
+
+        size_t chunkSize = ((count + chunkCount - 1) / chunkCount + 3) & ~(size_t)3;
+        std::vector<std::thread> threads;
+        for (size_t begin = chunkSize; begin < count; begin += chunkSize)
+            threads.emplace_back(task, begin, std::min(begin + chunkSize, count));
+        task((size_t)0, std::min(chunkSize, count));
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    /* Computes unnormalized tangents and bitangents of a range of triangles */
+    static void computeTriangles(const GLfloat* vertices, int offset, const GLuint* indices,
+        const Frames& triangles, size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; t++) {
+            const GLfloat* v0 = vertices + (size_t)indices[t * 3] * offset;
+            const GLfloat* v1 = vertices + (size_t)indices[t * 3 + 1] * offset;
+            const GLfloat* v2 = vertices + (size_t)indices[t * 3 + 2] * offset;
+
+            glm::vec3 deltaPos1 = glm::make_vec3(v1) - glm::make_vec3(v0);
+            glm::vec3 deltaPos2 = glm::make_vec3(v2) - glm::make_vec3(v0);
+            glm::vec2 deltaUV1 = glm::make_vec2(v1 + 6) - glm::make_vec2(v0 + 6);
+            glm::vec2 deltaUV2 = glm::make_vec2(v2 + 6) - glm::make_vec2(v0 + 6);
+
+            // Triangles without UV area add nothing instead of dividing by zero
+            float determinant = deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x;
+            float r = std::abs(determinant) > DEGENERATE_UV ? 1.f / determinant : 0.f;
+
+            glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
+            glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+            for (int axis = 0; axis < 3; axis++) {
+                triangles.get(axis)[t] = tangent[axis];
+                triangles.get(3 + axis)[t] = bitangent[axis];
+            }
+        }
+    }
+
+    /* Orthonormalizes the summed tangent of a vertex against its normal
+    *  The bitangent is rebuilt from the normal and tangent, keeping the
+    *  handedness of the summed bitangent.
+    */
+    static void orthonormalize(GLfloat* vertex, const Frames& accumulated, size_t v) {
+        glm::vec3 tangent(accumulated.get(0)[v], accumulated.get(1)[v], accumulated.get(2)[v]);
+        glm::vec3 bitangent(accumulated.get(3)[v], accumulated.get(4)[v], accumulated.get(5)[v]);
+
+        // Meshes without normals fall back to the normal of the UV frame
+        glm::vec3 normal = glm::make_vec3(vertex + 3);
+        if (!(glm::dot(normal, normal) > 1e-12f))
+            normal = glm::cross(tangent, bitangent);
+        normal = glm::dot(normal, normal) > 1e-12f ? glm::normalize(normal) : glm::vec3(0, 0, 1);
+
+        tangent -= normal * glm::dot(normal, tangent);
+        if (glm::dot(tangent, tangent) > 1e-12f && std::isfinite(tangent.x + tangent.y + tangent.z))
+            tangent = glm::normalize(tangent);
+        else {
+            glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+            tangent = glm::normalize(glm::cross(normal, axis));
+        }
+        float sign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.f ? -1.f : 1.f;
+        bitangent = glm::cross(normal, tangent) * sign;
+
+        for (int axis = 0; axis < 3; axis++) {
+            vertex[8 + axis] = tangent[axis];
+            vertex[11 + axis] = bitangent[axis];
+        }
+    }
+
+#ifdef USE_SSE
+    /* Same as computeTriangles, four triangles at a time */
+    static void computeTrianglesSse(const GLfloat* vertices, int offset, const GLuint* indices,
+        const Frames& triangles, size_t begin, size_t end)
+    {
+        size_t t = begin;
+        for (; t + 4 <= end; t += 4) {
+            // Gather positions and UVs of the four triangles into one register per component
+            __m128 p[3][3], uv[3][2];
+            for (int corner = 0; corner < 3; corner++) {
+                const GLfloat* v[4];
+                for (int lane = 0; lane < 4; lane++)
+                    v[lane] = vertices + (size_t)indices[(t + lane) * 3 + corner] * offset;
+                for (int axis = 0; axis < 3; axis++)
+                    p[corner][axis] = _mm_setr_ps(v[0][axis], v[1][axis], v[2][axis], v[3][axis]);
+                for (int axis = 0; axis < 2; axis++)
+                    uv[corner][axis] = _mm_setr_ps(v[0][6 + axis], v[1][6 + axis], v[2][6 + axis], v[3][6 + axis]);
+            }
+
+            __m128 deltaU1 = _mm_sub_ps(uv[1][0], uv[0][0]);
+            __m128 deltaV1 = _mm_sub_ps(uv[1][1], uv[0][1]);
+            __m128 deltaU2 = _mm_sub_ps(uv[2][0], uv[0][0]);
+            __m128 deltaV2 = _mm_sub_ps(uv[2][1], uv[0][1]);
+
+            // Zero r on lanes without UV area
+            __m128 determinant = _mm_sub_ps(_mm_mul_ps(deltaU1, deltaV2), _mm_mul_ps(deltaV1, deltaU2));
+            __m128 magnitude = _mm_andnot_ps(_mm_set1_ps(-0.f), determinant);
+            __m128 valid = _mm_cmpgt_ps(magnitude, _mm_set1_ps(DEGENERATE_UV));
+            __m128 r = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(1.f),
+                _mm_or_ps(_mm_and_ps(valid, determinant), _mm_andnot_ps(valid, _mm_set1_ps(1.f)))));
+
+            for (int axis = 0; axis < 3; axis++) {
+                __m128 deltaPos1 = _mm_sub_ps(p[1][axis], p[0][axis]);
+                __m128 deltaPos2 = _mm_sub_ps(p[2][axis], p[0][axis]);
+                __m128 tangent = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(deltaPos1, deltaV2), _mm_mul_ps(deltaPos2, deltaV1)), r);
+                __m128 bitangent = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(deltaPos2, deltaU1), _mm_mul_ps(deltaPos1, deltaU2)), r);
+                _mm_storeu_ps(triangles.get(axis) + t, tangent);
+                _mm_storeu_ps(triangles.get(3 + axis) + t, bitangent);
+            }
+        }
+        computeTriangles(vertices, offset, indices, triangles, t, end);
+    }
+
+    /* Same as orthonormalize, four vertices at a time
+    *  Groups with a missing normal or a tangent parallel to it take the scalar path.
+    */
+    static void orthonormalizeSse(GLfloat* vertices, int offset, const Frames& accumulated, size_t begin, size_t end) {
+        const __m128 epsilon = _mm_set1_ps(1e-12f);
+        size_t v = begin;
+        for (; v + 4 <= end; v += 4) {
+            GLfloat* vertex[4];
+            for (int lane = 0; lane < 4; lane++)
+                vertex[lane] = vertices + (v + lane) * offset;
+
+            __m128 n[3], t[3], b[3];
+            for (int axis = 0; axis < 3; axis++) {
+                n[axis] = _mm_setr_ps(vertex[0][3 + axis], vertex[1][3 + axis], vertex[2][3 + axis], vertex[3][3 + axis]);
+                t[axis] = _mm_loadu_ps(accumulated.get(axis) + v);
+                b[axis] = _mm_loadu_ps(accumulated.get(3 + axis) + v);
+            }
+
+            // Normalize the normal and remove its part from the tangent
+            __m128 normalLength2 = dot3(n, n);
+            __m128 normalScale = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(normalLength2));
+            for (int axis = 0; axis < 3; axis++)
+                n[axis] = _mm_mul_ps(n[axis], normalScale);
+            __m128 projection = dot3(n, t);
+            for (int axis = 0; axis < 3; axis++)
+                t[axis] = _mm_sub_ps(t[axis], _mm_mul_ps(n[axis], projection));
+            __m128 tangentLength2 = dot3(t, t);
+
+            // Comparisons are false for NaN, so non-finite lanes also fall back
+            __m128 valid = _mm_and_ps(_mm_cmpgt_ps(normalLength2, epsilon), _mm_cmpgt_ps(tangentLength2, epsilon));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(tangentLength2, _mm_set1_ps(FLT_MAX)));
+            if (_mm_movemask_ps(valid) != 0xF) {
+                for (int lane = 0; lane < 4; lane++)
+                    orthonormalize(vertex[lane], accumulated, v + lane);
+                continue;
+            }
+
+            __m128 tangentScale = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(tangentLength2));
+            for (int axis = 0; axis < 3; axis++)
+                t[axis] = _mm_mul_ps(t[axis], tangentScale);
+
+            // Rebuilt bitangent with the handedness of the summed one
+            __m128 cross[3] = {
+                _mm_sub_ps(_mm_mul_ps(n[1], t[2]), _mm_mul_ps(n[2], t[1])),
+                _mm_sub_ps(_mm_mul_ps(n[2], t[0]), _mm_mul_ps(n[0], t[2])),
+                _mm_sub_ps(_mm_mul_ps(n[0], t[1]), _mm_mul_ps(n[1], t[0]))
+            };
+            __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot3(cross, b), _mm_setzero_ps()), _mm_set1_ps(-0.f));
+
+            float out[6][4];
+            for (int axis = 0; axis < 3; axis++) {
+                _mm_storeu_ps(out[axis], t[axis]);
+                _mm_storeu_ps(out[3 + axis], _mm_xor_ps(cross[axis], flip));
+            }
+            for (int lane = 0; lane < 4; lane++)
+                for (int component = 0; component < 6; component++)
+                    vertex[lane][8 + component] = out[component][lane];
+        }
+        for (; v < end; v++)
+            orthonormalize(vertices + v * offset, accumulated, v);
+    }
+
+    static __m128 dot3(const __m128* a, const __m128* b) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+    }
+#endif
+};
@@ -0,0 +1,344 @@
+#pragma once
+/* Uploads decoded images to textures through a ring of pixel unpack buffers
+*  Textures are allocated when queued and filled over the following frames: a
+*  worker copies rows of every mip level into a mapped buffer while the frame
+*  renders, then the GL thread unmaps it, uploads from it and fences it before
+*  the buffer is mapped again. Until all levels of a texture have arrived,
+*  resolve() returns a 1x1 placeholder to draw with instead.
+*
+*  Queue, update and resolve on the GL thread, update() once per frame.
+*/
+class TextureStreamer {
+public:
+    // Colors of the 1x1 textures drawn while the real ones upload
+    enum Placeholder { COLOR, NORMAL, CUBE, PLACEHOLDER_COUNT };
+
+private:
+    // Buffers in the ring and bytes copied into one buffer per fill
+    static const int RING_SIZE = 4;
+    static const size_t BUFFER_SIZE = 2 * 1024 * 1024;
+
+    /* Image uploading to one texture target */
+    struct Upload {
+        GLuint texture;
+        GLenum bindTarget;
+        GLenum imageTarget;
+        GLenum format;
+        Image image;
+        int piecesLeft;
+    };
+
+    /* Band of rows of one mip level, uploaded from one buffer */
+    struct Piece {
+        Upload* upload;
+        int level;
+        int firstRow;
+        int rowCount;
+        size_t size;
+        size_t bufferOffset;
+    };
+
+    /* Texture drawn with a placeholder until its pieces have arrived */
+    struct Pending {
+        int piecesLeft = 0;
+        Placeholder placeholder = COLOR;
+    };
+
+    // Buffers cycle free -> copying on the worker -> uploading on the GPU -> free
+    enum SlotState { FREE, COPYING, IN_FLIGHT };
+
+    struct Slot {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+        SlotState state = FREE;
+        std::vector<Piece> pieces;
+        std::future<void> copy;
+        GLsync fence = 0;
+    };
+
+    Slot ring[RING_SIZE];
+    ThreadPool copier{ 1 };
+    std::deque<Upload> uploads;
+    std::deque<Piece> queued;
+    std::unordered_map<GLuint, Pending> pending;
+    GLuint placeholders[PLACEHOLDER_COUNT] = {};
+
+    // Throughput of the current run, from the first queued texture until all have arrived
+    bool streaming = false;
+    size_t uploadedBytes = 0;
+    int frames = 0;
+    double longestFrameMs = 0;
+    std::chrono::steady_clock::time_point runStart, lastUpdate;
+
+    static double elapsedMs(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - since).count();
+    }
+
+    /* Returns first source byte of a piece */
+    static const unsigned char* getSource(const Piece& piece) {
+        Image& image = piece.upload->image;
+        size_t rowSize = (size_t)Image::getLevelExtent(image.getWidth(), piece.level) * image.getChannels();
+        return image.getLevelPixels(piece.level) + piece.firstRow * rowSize;
+    }
+
+    /* Creates a 1x1 texture, or cube map with 1x1 faces */
+    static GLuint createPlaceholder(Placeholder kind) {
+        static const unsigned char colors[PLACEHOLDER_COUNT][4] = {
+            { 128, 128, 128, 255 }, // Mid grey
+            { 128, 128, 255, 255 }, // Flat normal
+            { 16, 32, 64, 255 }     // Deep water
+        };
+
+        GLuint tex;
+        GLenum target = kind == CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+        glGenTextures(1, &tex);
+        GLState::getCurrent().bindTexture(GL_TEXTURE0, target, tex);
+        if (kind == CUBE)
+            for (int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0,
+                    GL_RGBA, GL_UNSIGNED_BYTE, colors[kind]);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors[kind]);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+        return tex;
+    }
+
+    /* Maps a free buffer and has the worker copy the next queued pieces into it */
+    void fill(Slot& slot) {
+        // The first piece always fits, buffers grow for rows wider than BUFFER_SIZE
+        size_t size = 0;
+        slot.pieces.clear();
+        while (!queued.empty() && (slot.pieces.empty() || size + queued.front().size <= BUFFER_SIZE)) {
+            Piece piece = queued.front();
+            queued.pop_front();
+            piece.bufferOffset = size;
+            size += piece.size;
+            slot.pieces.push_back(piece);
+        }
+
+        if (slot.buffer == 0)
+            glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (size > slot.capacity) {
+            slot.capacity = std::max(size, BUFFER_SIZE);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, nullptr, GL_STREAM_DRAW);
+        }
+
+        // The fence of the last upload from this buffer has signaled, so no need to synchronize
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!mapped) {
+            queued.insert(queued.begin(), slot.pieces.begin(), slot.pieces.end());
+            slot.pieces.clear();
+            return;
+        }
+
+        std::vector<Piece> pieces = slot.pieces;
+        slot.copy = copier.submit([pieces, mapped] {
+            for (const Piece& piece : pieces)
+                memcpy(mapped + piece.bufferOffset, getSource(piece), piece.size);
+        });
+        slot.state = COPYING;
+    }
+
+    /* Unmaps a filled buffer and uploads its pieces from it */
+    void submit(Slot& slot) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+            // Buffer contents were lost, copy the pieces again
+            queued.insert(queued.begin(), slot.pieces.begin(), slot.pieces.end());
+            slot.pieces.clear();
+            slot.state = FREE;
+            return;
+        }
+
+        for (const Piece& piece : slot.pieces) {
+            const Upload& upload = *piece.upload;
+            GLState::getCurrent().bindTexture(GL_TEXTURE0, upload.bindTarget, upload.texture);
+            glTexSubImage2D(upload.imageTarget, piece.level, 0, piece.firstRow,
+                Image::getLevelExtent(upload.image.getWidth(), piece.level), piece.rowCount,
+                upload.format, GL_UNSIGNED_BYTE, (void*)piece.bufferOffset);
+        }
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.state = IN_FLIGHT;
+    }
+
+    /* Marks the pieces of a buffer the GPU has finished reading as arrived */
+    void complete(Slot& slot) {
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        for (const Piece& piece : slot.pieces) {
+            uploadedBytes += piece.size;
+            if (--piece.upload->piecesLeft == 0)
+                piece.upload->image.release();
+
+            std::unordered_map<GLuint, Pending>::iterator found = pending.find(piece.upload->texture);
+            if (--found->second.piecesLeft == 0)
+                pending.erase(found);
+        }
+        slot.pieces.clear();
+        slot.state = FREE;
+    }
+
+public:
+    TextureStreamer() {}
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    /* Allocates every level of a texture target and queues its pixels for upload
+    *  @param texture - texture to fill, bound to bindTarget
+    *  @param bindTarget - GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    *  @param imageTarget - bindTarget, or the cube map face to fill
+    *  @param image - decoded image, its pixels are held until uploaded
+    *  @param format - internal format, pixels are read in the format of the image channels
+    *  @param placeholder - texture to resolve to until the upload finishes
+    */
+    void queue(GLuint texture, GLenum bindTarget, GLenum imageTarget, Image& image, GLenum format,
+        Placeholder placeholder)
+    {
+        if (!image.isLoaded())
+            return;
+
+        // Storage only, so the unpack buffer must not be bound
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        GLState::getCurrent().bindTexture(GL_TEXTURE0, bindTarget, texture);
+        for (int level = 0; level < image.getLevels(); level++)
+            glTexImage2D(imageTarget, level, format,
+                Image::getLevelExtent(image.getWidth(), level),
+                Image::getLevelExtent(image.getHeight(), level),
+                0, image.getFormat(), GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(bindTarget, GL_TEXTURE_MAX_LEVEL, image.getLevels() - 1);
+        if (const GLint* swizzle = image.getSwizzle())
+            glTexParameteriv(bindTarget, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+
+        Upload upload = { texture, bindTarget, imageTarget, image.getFormat(), image, 0 };
+        uploads.push_back(upload);
+        Upload* queuedUpload = &uploads.back();
+
+        // Split levels into bands of rows that fit a buffer, small levels share one
+        for (int level = 0; level < image.getLevels(); level++) {
+            int height = Image::getLevelExtent(image.getHeight(), level);
+            size_t rowSize = (size_t)Image::getLevelExtent(image.getWidth(), level) * image.getChannels();
+            int bandRows = (int)std::max<size_t>(BUFFER_SIZE / rowSize, 1);
+            for (int row = 0; row < height; row += bandRows) {
+                Piece piece = {};
+                piece.upload = queuedUpload;
+                piece.level = level;
+                piece.firstRow = row;
+                piece.rowCount = std::min(bandRows, height - row);
+                piece.size = piece.rowCount * rowSize;
+                queued.push_back(piece);
+                queuedUpload->piecesLeft++;
+            }
+        }
+
+        Pending& waiting = pending[texture];
+        waiting.piecesLeft += queuedUpload->piecesLeft;
+        waiting.placeholder = placeholder;
+        if (placeholders[placeholder] == 0)
+            placeholders[placeholder] = createPlaceholder(placeholder);
+
+        if (!streaming) {
+            streaming = true;
+            uploadedBytes = 0;
+            frames = 0;
+            longestFrameMs = 0;
+            runStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    /* Creates a 2D texture and queues an image for upload to it
+    *  @returns texture name, usable right away through resolve()
+    */
+    GLuint queue(Image& image, GLenum format, Placeholder placeholder) {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        queue(tex, GL_TEXTURE_2D, GL_TEXTURE_2D, image, format, placeholder);
+        return tex;
+    }
+
+    /* Advances every buffer of the ring by one step, call once per frame */
+    void update() {
+        if (!streaming)
+            return;
+
+        // Frame times while streaming, the first interval still includes loading
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (frames > 0)
+            longestFrameMs = std::max(longestFrameMs,
+                std::chrono::duration<double, std::milli>(now - lastUpdate).count());
+        lastUpdate = now;
+        frames++;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (Slot& slot : ring) {
+            if (slot.state == IN_FLIGHT) {
+                GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+                    complete(slot);
+            }
+            if (slot.state == COPYING &&
+                slot.copy.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                submit(slot);
+            if (slot.state == FREE && !queued.empty())
+                fill(slot);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (pending.empty()) {
+            double ms = elapsedMs(runStart);
+            double megabytes = uploadedBytes / (1024.0 * 1024.0);
+            std::cout << "Texture streaming: " << megabytes << " MB in " << ms << " ms over " << frames
+                << " frames, " << megabytes / (ms / 1000.0) << " MB/s, longest frame "
+                << longestFrameMs << " ms" << std::endl;
+            uploads.clear();
+            streaming = false;
+        }
+    }
+
+    /* Returns the texture to draw with, its placeholder while it is uploading */
+    GLuint resolve(GLuint texture) {
+        if (pending.empty())
+            return texture;
+        std::unordered_map<GLuint, Pending>::iterator found = pending.find(texture);
+        if (found == pending.end())
+            return texture;
+        return placeholders[found->second.placeholder];
+    }
+
+    /* Returns a placeholder to draw with for a texture that has no pixels yet, such as one loaded again */
+    GLuint getPlaceholder(Placeholder placeholder) {
+        if (placeholders[placeholder] == 0)
+            placeholders[placeholder] = createPlaceholder(placeholder);
+        return placeholders[placeholder];
+    }
+
+    /* Getters */
+    bool isStreaming() {
+        return streaming;
+    }
+
+    /* Deletion of buffers and placeholders, waits for copies in progress */
+    void cleanup() {
+        for (Slot& slot : ring) {
+            if (slot.state == COPYING) {
+                slot.copy.wait();
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.buffer);
+            slot = Slot();
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        GLState::getCurrent().deleteTextures(PLACEHOLDER_COUNT, placeholders);
+        std::fill(placeholders, placeholders + PLACEHOLDER_COUNT, 0);
+
+        queued.clear();
+        pending.clear();
+        uploads.clear();
+        streaming = false;
+    }
+};
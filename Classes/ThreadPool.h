@@ -0,0 +1,77 @@
+#pragma once
+/* Fixed set of worker threads that run queued tasks
+*  Tasks must not make OpenGL calls, the context is only current on the
+*  main thread.
+*/
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    bool stopping = false;
+
+    /* Runs queued tasks until the pool is stopped */
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    /* Starts worker threads
+    *  @param threadCount (optional) - number of workers, defaults to one per hardware thread
+    */
+    ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency()) {
+        if (threadCount == 0)
+            threadCount = 1;
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /* Finishes queued tasks and joins workers */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    /* Getters */
+    size_t getThreadCount() {
+        return workers.size();
+    }
+
+    /* Queues a task to run on a worker thread
+    *  @param task - callable taking no arguments
+    *  @returns future holding the result of the task
+    */
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())> {
+        typedef decltype(task()) Result;
+        std::shared_ptr<std::packaged_task<Result()>> packaged =
+            std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.push([packaged] { (*packaged)(); });
+        }
+        queueReady.notify_one();
+        return result;
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+/* Packs interleaved float vertices into a compact layout
+*  Positions are quantized to 16-bit unsigned normalized values against the
+*  mesh bounds, normals and tangents are stored as signed normalized 10_10_10_2
+*  and UVs as half floats. The bitangent is dropped, its handedness is kept in
+*  the 2-bit w of the tangent and the vertex shader rebuilds it from the normal.
+*
+*  Packed layout, 16 bytes per vertex (20 with tangents):
+*    ushort position[4]   normalized, w is padding
+*    uint normal          GL_INT_2_10_10_10_REV
+*    half uv[2]
+*    uint tangent         GL_INT_2_10_10_10_REV, w is bitangent sign
+*/
+class VertexPacker {
+public:
+    // Largest errors introduced by packing a mesh
+    struct Error {
+        float position = 0;     // Model units
+        float normal = 0;       // Degrees
+        float tangent = 0;      // Degrees
+        float uv = 0;
+    };
+
+    /* Returns bytes per packed vertex */
+    static int getStride(bool withTangents) {
+        return withTangents ? 20 : 16;
+    }
+
+    /* Packs interleaved float vertices
+    *  @param vertices - interleaved vertex data (position, normal, uv[, tangent, bitangent])
+    *  @param vertexCount - number of vertices
+    *  @param offset - floats per vertex, 8 or 14
+    *  @param packed - receives packed vertices
+    *  @param boundsMin - receives the position that quantized zero maps to
+    *  @param boundsExtent - receives the size of the quantization range per axis
+    *  @returns largest errors of the packed data
+    */
+    static Error pack(const GLfloat* vertices, size_t vertexCount, int offset,
+        std::vector<unsigned char>& packed, glm::vec3& boundsMin, glm::vec3& boundsExtent)
+    {
+        Error error;
+        bool withTangents = offset >= 14;
+        int stride = getStride(withTangents);
+        packed.assign(vertexCount * stride, 0);
+
+        // Quantization range from the mesh bounds
+        boundsMin = glm::vec3(FLT_MAX);
+        glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t v = 0; v < vertexCount; v++) {
+            glm::vec3 position = glm::make_vec3(vertices + v * offset);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+        if (vertexCount == 0)
+            boundsMin = boundsMax = glm::vec3(0);
+        boundsExtent = boundsMax - boundsMin;
+
+        for (size_t v = 0; v < vertexCount; v++) {
+            const GLfloat* in = vertices + v * offset;
+            unsigned char* out = packed.data() + v * stride;
+
+            // Position
+            glm::vec3 position = glm::make_vec3(in);
+            GLushort quantized[4] = { 0, 0, 0, 0 };
+            glm::vec3 decoded;
+            for (int axis = 0; axis < 3; axis++) {
+                float t = boundsExtent[axis] > 0 ? (position[axis] - boundsMin[axis]) / boundsExtent[axis] : 0.f;
+                quantized[axis] = (GLushort)(glm::clamp(t, 0.f, 1.f) * 65535.f + 0.5f);
+                decoded[axis] = boundsMin[axis] + quantized[axis] / 65535.f * boundsExtent[axis];
+            }
+            memcpy(out, quantized, sizeof(quantized));
+            error.position = std::max(error.position, glm::length(decoded - position));
+
+            // Normal
+            glm::vec3 normal = safeNormalize(glm::make_vec3(in + 3), glm::vec3(0, 0, 1));
+            glm::uint packedNormal = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.f));
+            memcpy(out + 8, &packedNormal, 4);
+            error.normal = std::max(error.normal,
+                angleBetween(normal, glm::vec3(glm::unpackSnorm3x10_1x2(packedNormal))));
+
+            // UV
+            glm::vec2 uv = glm::vec2(in[6], in[7]);
+            glm::uint packedUv = glm::packHalf2x16(uv);
+            memcpy(out + 12, &packedUv, 4);
+            glm::vec2 uvError = glm::abs(glm::unpackHalf2x16(packedUv) - uv);
+            error.uv = std::max(error.uv, std::max(uvError.x, uvError.y));
+
+            if (!withTangents)
+                continue;
+
+            // Tangent orthogonalized against the normal, bitangent kept as a sign
+            glm::vec3 tangent = glm::make_vec3(in + 8);
+            glm::vec3 bitangent = glm::make_vec3(in + 11);
+            tangent = safeNormalize(tangent - normal * glm::dot(normal, tangent), perpendicular(normal));
+            float sign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.f ? -1.f : 1.f;
+            glm::uint packedTangent = glm::packSnorm3x10_1x2(glm::vec4(tangent, sign));
+            memcpy(out + 16, &packedTangent, 4);
+            error.tangent = std::max(error.tangent,
+                angleBetween(tangent, glm::vec3(glm::unpackSnorm3x10_1x2(packedTangent))));
+        }
+
+        return error;
+    }
+
+    /* Describes packed vertices to the bound VAO and array buffer
+    *  @param withTangents - layout includes the tangent
+    */
+    static void setAttribPointers(bool withTangents) {
+        GLsizei stride = getStride(withTangents);
+
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)8);
+        glEnableVertexAttribArray(1);
+
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)12);
+        glEnableVertexAttribArray(2);
+
+        if (withTangents) {
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)16);
+            glEnableVertexAttribArray(3);
+        }
+    }
+
+private:
+    static glm::vec3 safeNormalize(glm::vec3 v, glm::vec3 fallback) {
+        float length = glm::length(v);
+        if (!(length > 1e-12f) || !std::isfinite(length))
+            return fallback;
+        return v / length;
+    }
+
+    /* Returns a unit vector perpendicular to the given unit vector */
+    static glm::vec3 perpendicular(glm::vec3 v) {
+        glm::vec3 axis = std::abs(v.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+        return glm::normalize(glm::cross(v, axis));
+    }
+
+    /* Returns angle between two directions in degrees */
+    static float angleBetween(glm::vec3 a, glm::vec3 b) {
+        float cosine = glm::dot(glm::normalize(a), glm::normalize(b));
+        return glm::degrees(std::acos(glm::clamp(cosine, -1.f, 1.f)));
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+/* Merges identical interleaved vertices into a unique vertex buffer
+*  Vertices are compared bit for bit, so only exact duplicates are welded.
+*  Each added vertex returns the index of its unique copy, which is used
+*  to build the index buffer of the mesh.
+*/
+class VertexWelder {
+private:
+    // Hashes and compares vertices stored in the unique vertex buffer
+    struct VertexHash {
+        const std::vector<GLfloat>* vertices;
+        int offset;
+
+        size_t operator()(GLuint index) const {
+            // FNV-1a over the raw bytes of the vertex
+            const unsigned char* bytes = (const unsigned char*)(vertices->data() + (size_t)index * offset);
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < offset * sizeof(GLfloat); i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return (size_t)hash;
+        }
+    };
+    struct VertexEqual {
+        const std::vector<GLfloat>* vertices;
+        int offset;
+
+        bool operator()(GLuint a, GLuint b) const {
+            return memcmp(vertices->data() + (size_t)a * offset,
+                vertices->data() + (size_t)b * offset,
+                offset * sizeof(GLfloat)) == 0;
+        }
+    };
+
+    std::vector<GLfloat>& vertices;
+    int offset;
+    std::unordered_set<GLuint, VertexHash, VertexEqual> unique;
+
+public:
+    /* @param vertices - unique vertex buffer to append to
+    *  @param offset - floats per vertex
+    *  @param expectedCount (optional) - number of vertices that will be added
+    */
+    VertexWelder(std::vector<GLfloat>& vertices, int offset, size_t expectedCount = 0)
+        : vertices(vertices), offset(offset),
+        unique(expectedCount, VertexHash{ &vertices, offset }, VertexEqual{ &vertices, offset })
+    {
+        vertices.reserve(vertices.size() + expectedCount * offset);
+    }
+
+    VertexWelder(const VertexWelder&) = delete;
+    VertexWelder& operator=(const VertexWelder&) = delete;
+
+    /* Adds a vertex to the unique vertex buffer unless an identical one exists
+    *  @param vertex - pointer to offset floats
+    *  @returns index of the unique vertex
+    */
+    GLuint add(const GLfloat* vertex) {
+        // Append as a candidate so it can be hashed in place, drop it if it is a duplicate
+        GLuint index = (GLuint)(vertices.size() / offset);
+        vertices.insert(vertices.end(), vertex, vertex + offset);
+
+        std::pair<std::unordered_set<GLuint, VertexHash, VertexEqual>::iterator, bool> result = unique.insert(index);
+        if (!result.second)
+            vertices.resize(vertices.size() - offset);
+        return *result.first;
+    }
+
+    /* Getters */
+    size_t getVertexCount() {
+        return vertices.size() / offset;
+    }
+};
@@ -6,11 +6,17 @@ layout(location = 2) in vec2 aTex;
 out vec2 texCoord;
 
 uniform mat4 transform;
-uniform mat4 projection;
-uniform mat4 view;
+
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
 void main() {
-	gl_Position = projection * view * transform * vec4(aPos, 1.0);
+	gl_Position = viewProjection * transform * vec4(aPos, 1.0);
 
 	texCoord = aTex;
 }
\ No newline at end of file
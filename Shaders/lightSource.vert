@@ -4,9 +4,15 @@
 layout(location = 0) in vec3 aPos;
 
 uniform mat4 transform;
-uniform mat4 projection;
-uniform mat4 view;
+
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
 void main() {
-	gl_Position = projection * view * transform * vec4(aPos, 1.0);
+	gl_Position = viewProjection * transform * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #version 330 core //version
 
+// Members ordered so floats fill the tail of the vec3 before them, the std140 layout of FrameUniforms
 struct DirectionLight {
 	vec3 direction;
-	vec3 color;
 	float strength;
+	vec3 color;
 	float ambientStr;
 	vec3 ambientColor;
 	float specStr;
@@ -12,11 +13,11 @@ struct DirectionLight {
 
 struct PointLight {
 	vec3 position;
-	vec3 color;
 	float linear;
+	vec3 color;
 	float quadratic;
-	float ambientStr;
 	vec3 ambientColor;
+	float ambientStr;
 	float specStr;
 	float specPhong;
 };
@@ -24,12 +25,24 @@ struct PointLight {
 in vec2 texCoord;
 in vec3 normCoord;
 in vec3 fragPos;
+#ifdef INSTANCE_ATTRIBUTES
+in vec4 tint;
+#endif
 
 uniform sampler2D tex0;
-uniform vec3 cameraPos;
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
-uniform DirectionLight directionLight;
-uniform PointLight pointLight;
+// Lights of the frame, shared by all programs at binding point 1
+layout(std140) uniform Lights {
+	DirectionLight directionLight;
+	PointLight pointLight;
+};
 
 uniform int isFPP;
 uniform vec4 filterColor;
@@ -109,4 +122,7 @@ void main() {
 	result += (diffuse + ambientCol + specCol);
 
 	FragColor = vec4(result, 1.0f) * pixelColor;
+#ifdef INSTANCE_ATTRIBUTES
+	FragColor *= tint;
+#endif
 }
\ No newline at end of file
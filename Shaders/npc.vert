@@ -4,24 +4,62 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 vertexNormal;
 layout(location = 2) in vec2 aTex;
 
+#ifdef PACKED_VERTICES
+// Quantization range of positions, set per model as constant attributes
+layout(location = 5) in vec3 positionMin;
+layout(location = 6) in vec3 positionExtent;
+#endif
+
 out vec2 texCoord;
 out vec3 normCoord;
 out vec3 fragPos;
 
-uniform mat4 transform;
-uniform mat4 projection;
-uniform mat4 view;
+#ifdef INSTANCE_ATTRIBUTES
+// Transform, tint and normal matrix of each instance, read from the instance buffer of InstancedModel
+layout(location = 7) in mat4 instanceTransform;
+layout(location = 11) in vec4 instanceTint;
+layout(location = 12) in mat3 instanceNormalMatrix;
+
+out vec4 tint;
+#else
+#ifndef MAX_INSTANCES
+#define MAX_INSTANCES 32
+#endif
+
+// Transforms and normal matrices of the instances drawn by one call, single draws use the first
+uniform mat4 transforms[MAX_INSTANCES];
+uniform mat3 normalMatrices[MAX_INSTANCES];
+#endif
+
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
 void main() {
-	gl_Position = projection * view * transform * vec4(aPos, 1.0);
+#ifdef INSTANCE_ATTRIBUTES
+	mat4 transform = instanceTransform;
+	mat3 normalMatrix = instanceNormalMatrix;
+	tint = instanceTint;
+#else
+	mat4 transform = transforms[gl_InstanceID];
+	mat3 normalMatrix = normalMatrices[gl_InstanceID];
+#endif
+
+#ifdef PACKED_VERTICES
+	vec3 position = positionMin + aPos * positionExtent;
+#else
+	vec3 position = aPos;
+#endif
+
+	gl_Position = viewProjection * transform * vec4(position, 1.0);
 
 	texCoord = aTex;
 
-	normCoord = mat3(
-		transpose(
-			inverse(transform)
-		)
-	) * vertexNormal;
+	normCoord = normalMatrix * vertexNormal;
 
-	fragPos = vec3(transform * vec4(aPos, 1.0));
+	fragPos = vec3(transform * vec4(position, 1.0));
 }
\ No newline at end of file
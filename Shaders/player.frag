@@ -1,9 +1,10 @@
 #version 330 core //version
 
+// Members ordered so floats fill the tail of the vec3 before them, the std140 layout of FrameUniforms
 struct DirectionLight {
 	vec3 direction;
-	vec3 color;
 	float strength;
+	vec3 color;
 	float ambientStr;
 	vec3 ambientColor;
 	float specStr;
@@ -12,21 +13,30 @@ struct DirectionLight {
 
 struct PointLight {
 	vec3 position;
-	vec3 color;
 	float linear;
+	vec3 color;
 	float quadratic;
-	float ambientStr;
 	vec3 ambientColor;
+	float ambientStr;
 	float specStr;
 	float specPhong;
 };
 
 uniform sampler2D tex0;
 uniform sampler2D tex1;
-uniform vec3 cameraPos;
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
-uniform DirectionLight directionLight;
-uniform PointLight pointLight;
+// Lights of the frame, shared by all programs at binding point 1
+layout(std140) uniform Lights {
+	DirectionLight directionLight;
+	PointLight pointLight;
+};
 
 in vec2 texCoord;
 in vec3 normCoord;
@@ -3,36 +3,67 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 vertexNormal;
 layout(location = 2) in vec2 aTex;
+#ifdef PACKED_VERTICES
+// Tangent with bitangent sign in w
+layout(location = 3) in vec4 m_tan;
+
+// Quantization range of positions, set per model as constant attributes
+layout(location = 5) in vec3 positionMin;
+layout(location = 6) in vec3 positionExtent;
+#else
 layout(location = 3) in vec3 m_tan;
 layout(location = 4) in vec3 m_btan;
+#endif
 
 out vec2 texCoord;
 out vec3 normCoord;
 out vec3 fragPos;
 out mat3 TBN;
 
-uniform mat4 transform;
-uniform mat4 projection;
-uniform mat4 view;
+#ifndef MAX_INSTANCES
+#define MAX_INSTANCES 32
+#endif
+
+// Transforms and normal matrices of the instances drawn by one call, single draws use the first
+uniform mat4 transforms[MAX_INSTANCES];
+uniform mat3 normalMatrices[MAX_INSTANCES];
+
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
 void main() {
-	gl_Position = projection * view * transform * vec4(aPos, 1.0);
+	mat4 transform = transforms[gl_InstanceID];
+	mat3 normalMatrix = normalMatrices[gl_InstanceID];
 
-	texCoord = aTex;
+#ifdef PACKED_VERTICES
+	vec3 position = positionMin + aPos * positionExtent;
+#else
+	vec3 position = aPos;
+#endif
+
+	gl_Position = viewProjection * transform * vec4(position, 1.0);
 
-	mat3 modelMat = mat3(
-		transpose(
-			inverse(transform)
-		)
-	);
+	texCoord = aTex;
 
-	normCoord = modelMat * vertexNormal;
+	normCoord = normalMatrix * vertexNormal;
 
-	vec3 T = normalize(modelMat * m_tan);
-	vec3 B = normalize(modelMat * m_btan);
 	vec3 N = normalize(normCoord);
+#ifdef PACKED_VERTICES
+	// Rebuild bitangent from the normal, tangent and handedness
+	// The 2-bit w may decode to -1/3 under the pre-4.2 normalization, so only its sign is used
+	vec3 T = normalize(normalMatrix * m_tan.xyz);
+	vec3 B = cross(N, T) * sign(m_tan.w);
+#else
+	vec3 T = normalize(normalMatrix * m_tan);
+	vec3 B = normalize(normalMatrix * m_btan);
+#endif
 
 	TBN = mat3(T, B, N);
 
-	fragPos = vec3(transform * vec4(aPos, 1.0));
+	fragPos = vec3(transform * vec4(position, 1.0));
 }
\ No newline at end of file
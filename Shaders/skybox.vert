@@ -4,13 +4,26 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 texCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Normalized device depth of the far end, -1 or 0 with reversed depth
+#ifndef FAR_DEPTH
+#define FAR_DEPTH 1.0
+#endif
+
+// Sky keeps its own projection, only the rotation of the view is used
+uniform mat4 skyProjection;
+
+// Camera of the frame, shared by all programs at binding point 0
+layout(std140) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	mat4 viewProjection;
+	vec3 cameraPos;
+};
 
 void main() {
-	vec4 pos = projection * view * vec4(aPos, 1.0);
+	vec4 pos = skyProjection * mat4(mat3(view)) * vec4(aPos, 1.0);
 
-	gl_Position = vec4(pos.x, pos.y, pos.w, pos.w);
+	gl_Position = vec4(pos.x, pos.y, FAR_DEPTH * pos.w, pos.w);
 
 	texCoords = aPos;
 }
\ No newline at end of file
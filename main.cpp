@@ -1,3 +1,15 @@
+// Platform file mapping
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -6,17 +18,71 @@
 
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <cctype>
+#include <memory>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <queue>
+#include <deque>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
 using namespace std;
 
+// SSE intrinsics where the target guarantees them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE
+#include <emmintrin.h>
+#endif
+
+// Counts heap allocations of the render thread per frame when defined, needed by checkFrameAllocations
+//#define COUNT_ALLOCATIONS
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#include "Classes/Model.h"
+#include "Classes/GLState.h"
+#include "Classes/GLHandle.h"
+#include "Classes/RenderTarget.h"
+#include "Classes/SampleCounter.h"
+#include "Classes/ThreadPool.h"
+#include "Classes/AssetLoader.h"
+#include "Classes/MappedFile.h"
+#include "Classes/AssetPack.h"
+#include "Classes/Image.h"
+#include "Classes/TextureStreamer.h"
+#include "Classes/MemoryBudget.h"
 #include "Classes/ShaderManager.h"
+#include "Classes/MeshOptimizer.h"
+#include "Classes/MeshSimplifier.h"
+#include "Classes/MeshCache.h"
+#include "Classes/VertexWelder.h"
+#include "Classes/VertexPacker.h"
+#include "Classes/TangentGenerator.h"
+#include "Classes/RenderQueue.h"
+#include "Classes/FrustumCuller.h"
+#include "Classes/SceneBVH.h"
+#include "Classes/OcclusionCuller.h"
+#include "Classes/Model.h"
+#include "Classes/InstancedModel.h"
 #include "Classes/Skybox.h"
 #include "Classes/Camera.h"
 #include "Classes/PerspectiveCamera.h"
@@ -24,8 +90,32 @@ using namespace std;
 #include "Classes/Light.h"
 #include "Classes/DirectionLight.h"
 #include "Classes/PointLight.h"
+#include "Classes/FrameUniforms.h"
 #include "Classes/Player.h"
 
+#ifdef COUNT_ALLOCATIONS
+/* Heap allocations of each thread, counted by the replaced global operator new
+*  The frame loop reads the count of the render thread, so the loader, streaming and culling
+*  workers running during a frame are left out. Once warmed up it should make none.
+*/
+thread_local size_t heapAllocations = 0;
+
+void* operator new(std::size_t size) {
+    heapAllocations++;
+    if (void* block = std::malloc(size > 0 ? size : 1))
+        return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    std::free(block);
+}
+#endif
+
 /* Global variables */
 Player player;
 
@@ -34,6 +124,63 @@ OrthographicCamera orthoCam = OrthographicCamera(
     glm::vec3(0),
     glm::vec3(0, 0, -1.f));
 
+// Scene hierarchy over enemies, the player and debris, and the name of each range of its object ids
+SceneBVH sceneBvh;
+std::vector<std::pair<int, std::string>> sceneObjectNames;
+
+/* Render settings */
+// Draw into a floating-point depth buffer with reversed depth and perspective cameras without a far plane
+bool reverseDepth = true;
+
+// Draw the skybox after the opaque models so covered pixels skip its shader, off draws it first
+bool skyboxLast = true;
+
+// Upload models in the compact vertex layout of VertexPacker
+bool packVertices = true;
+
+// Baked assets written by the packer, loose files are read if it is missing
+std::string assetPackPath = "assets.pack";
+
+// Upload textures through pixel unpack buffers over the first frames, placeholders are drawn until then
+bool streamTextures = true;
+
+// Send uniforms through locations reflected at link time, off asks the driver by name on every send
+bool cacheUniformLocations = true;
+
+// Cull through the scene hierarchy, off tests the bounding sphere of every object
+bool useSceneBvh = true;
+
+// Hide objects behind the largest enemy models in a software depth buffer, filled a frame behind on a worker
+// Tests the boxes of the scene hierarchy, so it needs useSceneBvh
+bool useOcclusionCulling = true;
+int maxOccluders = 3;
+size_t occluderTriangles = 128;
+
+// Free the CPU copies of meshes once uploaded, evicted meshes are loaded again on the loader workers
+bool releaseGeometry = true;
+
+// GPU bytes assets may hold before the least recently drawn are evicted, 0 for no limit
+size_t gpuMemoryBudget = (size_t)256 * 1024 * 1024;
+
+/* Benchmarks */
+// Time tangent generation on the player and fish meshes before loading
+bool benchmarkTangents = false;
+
+// Time hierarchy builds, refits and queries at 1k, 10k and 100k objects before loading
+bool benchmarkBvh = false;
+
+// Time rebuilding the matrices of moved models one by one and in SSE batches before loading
+bool benchmarkTransforms = false;
+
+// Scatter this many instanced copies of the enemy meshes around the scene, 0 for the normal scene
+int stressDebrisCount = 0;
+
+// Count heap allocations of the render thread over frames after textures have streamed in and exit,
+// failing unless there were none. Needs COUNT_ALLOCATIONS, and scatters 2000 debris without a stress scene
+// so that instanced draws are counted too.
+bool checkFrameAllocations = false;
+const int allocationWarmupFrames = 120;
+const int allocationCheckFrames = 600;
 
 /* User controls */
 bool isTopDown = false;
@@ -43,6 +190,10 @@ double cursorX, cursorY;
 // Function declarations
 void Key_Callback(GLFWwindow* window, int key, int scanCode, int action, int mods);
 void CursorCallback(GLFWwindow* window, double xpos, double ypos);
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void BenchmarkTangents(std::string objPath);
+void BenchmarkBvh();
+void BenchmarkTransforms();
 
 int main(void)
 {
@@ -51,6 +202,15 @@ int main(void)
     float screenWidth = 720.f;
     float screenHeight = 720.f;
 
+#ifndef COUNT_ALLOCATIONS
+    if (checkFrameAllocations) {
+        std::cout << "Frame allocation check FAILED: COUNT_ALLOCATIONS is not defined" << std::endl;
+        return -1;
+    }
+#endif
+    if (checkFrameAllocations && stressDebrisCount == 0)
+        stressDebrisCount = 2000;
+
     /* Initialize the library */
     if (!glfwInit())
         return -1;
@@ -68,9 +228,49 @@ int main(void)
     // Initialize GLAD
     gladLoadGL();
 
-    Skybox skybox = Skybox();
-    stbi_set_flip_vertically_on_load(true);
+    // Depth convention every camera and draw follows, chosen before any is used
+    RenderTarget renderTarget;
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    renderTarget.init(framebufferWidth, framebufferHeight, reverseDepth);
+    std::cout << "Depth: " << RenderTarget::getConventionName()
+        << (RenderTarget::isReversed() ? ", 32-bit float buffer, no far plane" : ", window buffer") << std::endl;
+
+    // Tangent generation timings, before the loader workers compete for cores
+    if (benchmarkTangents) {
+        std::cout << "Tangent generation (best of 10 runs)" << std::endl;
+        std::string benchmarkMeshes[5] = { "3D/nemo.obj", "3D/dolphin.obj", "3D/goldfish.obj", "3D/shark.obj", "3D/fish.obj" };
+        for (int i = 0; i < 5; i++)
+            BenchmarkTangents(benchmarkMeshes[i]);
+    }
+    if (benchmarkBvh)
+        BenchmarkBvh();
+    if (benchmarkTransforms)
+        BenchmarkTransforms();
 
+    // Map the asset pack once, before any worker looks assets up in it
+    std::chrono::steady_clock::time_point mountStart = std::chrono::steady_clock::now();
+    if (AssetPack::mount(assetPackPath))
+        std::cout << "Asset pack: " << assetPackPath << ", " << AssetPack::getMounted().getEntryCount() << " entries, "
+            << AssetPack::getMounted().getSize() / (1024 * 1024) << " MB, mapped in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mountStart).count()
+            << " ms" << std::endl;
+    else
+        std::cout << "Asset pack: " << assetPackPath << " not found, loading loose files" << std::endl;
+
+    // Applies to every shader, set before any is created
+    ShaderManager::cachedLocations() = cacheUniformLocations;
+    MemoryBudget::get().setBudget(gpuMemoryBudget);
+
+    // Decode assets on worker threads, then upload them on this thread
+    AssetLoader loader;
+
+    Skybox skybox = Skybox();
+    std::vector<std::future<void>> faceTasks;
+    for (int i = 0; i < Skybox::FACE_COUNT; i++)
+        faceTasks.push_back(loader.load(Skybox::getFacePath(i), [&skybox, i] {
+            skybox.loadFace(i);
+        }));
 
     /*
         Player Positions near debris for testing:
@@ -82,10 +282,15 @@ int main(void)
     */
     
     // Create player
-    player = Player("3D/nemo.obj",
-        "3D/nemo.png", GL_RGBA,
-        "3D/nemo_normal.png", GL_RGBA,
-        glm::vec3(0), 1.5f, glm::vec3(180.f, 0, 0));
+    std::future<Player> playerTask = loader.load("3D/nemo.obj", [] {
+        Player loaded = Player("3D/nemo.obj",
+            "3D/nemo.png", GL_RGBA,
+            "3D/nemo_normal.png", GL_RGBA,
+            glm::vec3(0), 1.5f, glm::vec3(180.f, 0, 0));
+        if (packVertices)
+            loaded.packVertices();
+        return loaded;
+    });
 
     // Positions of enemy models
     float enemiesPos[6][3] =
@@ -128,43 +333,115 @@ int main(void)
         {"3D/fish.obj", "3D/bone.jpg"},
         {"3D/obelisk.obj", "3D/obelisk.jpg"}
     };
-    
+
+    // Texture formats of enemy models, only the crab texture has alpha
+    int enemiesTexFormat[6] = {
+        GL_RGBA,
+        GL_RGB,
+        GL_RGB,
+        GL_RGB,
+        GL_RGB,
+        GL_RGB
+    };
+
+    // Load enemy models in parallel
+    std::vector<std::future<Model>> enemyTasks;
+    for (int i = 0; i < 6; i++)
+        enemyTasks.push_back(loader.load(filenames[i][0], [&, i] {
+            Model enemy = Model(filenames[i][0],
+                filenames[i][1], enemiesTexFormat[i],
+                false, "", GL_RGB,
+                glm::make_vec3(enemiesPos[i]), enemiesSca[i], enemiesRot[i]);
+            if (useOcclusionCulling)
+                enemy.buildOccluder(occluderTriangles);
+            if (packVertices)
+                enemy.packVertices();
+            return enemy;
+        }));
+
+    // Upload assets as they finish decoding, textures only queue for streaming
+    TextureStreamer textureStreamer;
+    TextureStreamer* streamer = streamTextures ? &textureStreamer : nullptr;
+    for (int i = 0; i < Skybox::FACE_COUNT; i++)
+        faceTasks[i].get();
+    loader.upload("Skybox", [&] { skybox.initBuffers(streamer); });
+
+    player = playerTask.get();
+    loader.upload("3D/nemo.obj", [&] {
+        player.initBuffers(streamer, &loader);
+        if (releaseGeometry)
+            player.getPlayer().releaseGeometry();
+    });
+
     //Vector array of enemies
     std::vector<Model> enemies;
-    
-    //insert crab model to enemies vector
-    Model crab = Model(filenames[0][0],
-        filenames[0][1], GL_RGBA,
-        false, "", GL_RGB,
-        glm::make_vec3(enemiesPos[0]), enemiesSca[0], enemiesRot[0]);
-    crab.initBuffers();
-    enemies.push_back(crab);
-
-    //Push back remaining enemies
-    Model model;
-    for (int i = 0; i < 5; i++) {
-        model = Model(filenames[i+1][0],
-            filenames[i+1][1], GL_RGB,
-            false, "", GL_RGB,
-            glm::make_vec3(enemiesPos[i+1]), enemiesSca[i+1], enemiesRot[i+1]);
-        model.initBuffers();
-        enemies.push_back(model);
+    for (int i = 0; i < 6; i++) {
+        enemies.push_back(enemyTasks[i].get());
+        loader.upload(filenames[i][0], [&] {
+            enemies.back().initBuffers(streamer, &loader);
+            if (releaseGeometry)
+                enemies.back().releaseGeometry();
+        });
     }
+    loader.report();
 
-    // Set player camera as default
-    Camera activeCamera = (Camera)player.getActiveCamera();
+    // Vertex counts before and after welding
+    std::cout << "Mesh vertices (expanded -> welded)" << std::endl;
+    player.getPlayer().printVertexCounts("3D/nemo.obj");
+    for (int i = 0; i < 6; i++)
+        enemies[i].printVertexCounts(filenames[i][0]);
+
+    // Post-transform cache efficiency before and after optimization
+    std::cout << "Vertex cache (FIFO " << MeshOptimizer::CACHE_SIZE << ")" << std::endl;
+    player.getPlayer().printCacheStats("3D/nemo.obj");
+    for (int i = 0; i < 6; i++)
+        enemies[i].printCacheStats(filenames[i][0]);
+
+    // Submeshes drawn per model, one draw call per texture
+    std::cout << "Submeshes" << std::endl;
+    player.getPlayer().printSubmeshes("3D/nemo.obj");
+    for (int i = 0; i < 6; i++)
+        enemies[i].printSubmeshes(filenames[i][0]);
+
+    // Triangle counts of the levels of detail
+    std::cout << "Levels of detail" << std::endl;
+    for (int i = 0; i < 6; i++)
+        enemies[i].printLods(filenames[i][0]);
+
+    // Vertex buffer sizes and quantization errors of packed models
+    if (packVertices) {
+        std::cout << "Packed vertices (float -> packed, largest errors)" << std::endl;
+        player.getPlayer().printPackError("3D/nemo.obj");
+        for (int i = 0; i < 6; i++)
+            enemies[i].printPackError(filenames[i][0]);
+    }
+
+    // Memory held by every asset once uploaded
+    std::cout << "Asset memory" << (releaseGeometry ? " (geometry released after upload)" : "") << std::endl;
+    MemoryBudget::get().printAssets();
+
+    // Set player camera as default, pointed at so the cached matrices of the camera are used
+    Camera* activeCamera = &player.getActiveCamera();
 
     glEnable(GL_DEPTH_TEST);
+    GLState::getCurrent().setDepthFunc(RenderTarget::getDepthFunc());
 
     // Set callbacks
     glfwSetKeyCallback(window, Key_Callback);
     glfwSetCursorPosCallback(window, CursorCallback);
+    glfwSetMouseButtonCallback(window, MouseButtonCallback);
 
     // Create vertex and fragment shader managers
     ShaderManager filterShader = ShaderManager("filter");
-    ShaderManager playerShader = ShaderManager("player");
-    ShaderManager npcShader = ShaderManager("npc");
+    std::string modelDefines = "#define MAX_INSTANCES " + std::to_string(RenderQueue::MAX_INSTANCES);
+    if (packVertices)
+        modelDefines += "\n#define PACKED_VERTICES";
+    ShaderManager playerShader = ShaderManager("player", modelDefines);
+    ShaderManager npcShader = ShaderManager("npc", modelDefines);
     ShaderManager lightShader = ShaderManager("lightSource");
+    ShaderManager debrisShader = ShaderManager("npc", modelDefines + "\n#define INSTANCE_ATTRIBUTES");
+    std::cout << "Reflected uniforms: player " << playerShader.getUniformCount() << ", npc "
+        << npcShader.getUniformCount() << std::endl;
 
     DirectionLight directionLight = DirectionLight(
         glm::vec3(0, -5, 0), glm::vec3(1),
@@ -174,107 +451,399 @@ int main(void)
     directionLight.setIntensity(0.5f);
     glm::vec4 nvFilter = glm::vec4(0.05, 0.25, .05, 0.4);
 
+    // Camera and lights shared by all programs through uniform blocks
+    FrameUniforms frameUniforms;
+    frameUniforms.initBuffers();
+
+    // Sky fragments that pass the depth test, counted for each view
+    const char* viewNames[3] = { "TPP", "FPP", "top-down" };
+    SampleCounter skyFragments;
+    skyFragments.initBuffers();
+
+    // Draws the sky with the filter of the view
+    auto drawSkybox = [&] {
+        skyFragments.begin(isTopDown ? 2 : player.isFPP() ? 1 : 0);
+        // Change filter color depending on perspective
+        if (player.isFPP() && !isTopDown) {
+            skybox.resetFilterColor(nvFilter);
+            skybox.draw(1);
+        }
+        else {
+            skybox.resetFilterColor();
+            skybox.draw(0);
+        }
+        skyFragments.end();
+    };
+
+    // Per-draw uniforms of the model shaders, hashed at compile time
+    constexpr ShaderManager::Uniform<glm::vec4> filterColorUniform("filterColor");
+    constexpr ShaderManager::Uniform<int> isFPPUniform("isFPP");
+    constexpr ShaderManager::Uniform<int> tex0Uniform("tex0");
+
+    // Model draws of a frame, sorted and batched on flush
+    RenderQueue renderQueue;
+
+    // View frustum tests of the frame, enemy spheres are refilled each frame as models may move
+    FrustumCuller frustumCuller;
+    FrustumCuller::SphereSet enemySpheres;
+    std::vector<unsigned char> enemyVisible;
+
+    // Stress scene debris, every mesh drawn at its coarsest level of detail with one call per texture
+    // The obelisk is left out, it is scaled to fill the scene. Meshes that would get no instances get no group,
+    // so every group has objects in the scene hierarchy.
+    std::vector<InstancedModel> debris;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for (int i = 0; i < 5 && i < stressDebrisCount; i++) {
+        InstancedModel pieces = InstancedModel(enemies[i]);
+        pieces.setLodLevel(enemies[i].getLodCount() - 1);
+        for (int n = i; n < stressDebrisCount; n += 5) {
+            glm::vec3 position = glm::vec3(unit(random) * 800.f - 400.f, unit(random) * 350.f - 300.f,
+                unit(random) * 800.f - 400.f);
+            glm::vec3 rotation = glm::vec3(unit(random), unit(random), unit(random)) * 360.f;
+            float tintValue = 0.6f + unit(random) * 0.4f;
+            pieces.add(position, rotation, enemiesSca[i] * (0.3f + unit(random) * 0.7f),
+                glm::vec4(tintValue, tintValue, 0.8f + unit(random) * 0.2f, 1.f));
+        }
+        pieces.initBuffers();
+        debris.push_back(std::move(pieces));
+    }
+    if (!debris.empty()) {
+        size_t debrisTriangles = 0;
+        for (InstancedModel& pieces : debris)
+            debrisTriangles += pieces.getTriangleCount();
+        std::cout << "Stress scene: " << stressDebrisCount << " debris instances, " << debrisTriangles
+            << " triangles" << std::endl;
+    }
+
+    // Enemies, the player and every debris instance in the scene hierarchy, moves refit it
+    for (int i = 0; i < 6; i++)
+        sceneObjectNames.push_back(std::make_pair(enemies[i].attachBvh(sceneBvh), filenames[i][0]));
+    int playerObject = player.attachBvh(sceneBvh);
+    sceneObjectNames.push_back(std::make_pair(playerObject, std::string("3D/nemo.obj")));
+    std::vector<int> debrisObjects;
+    for (size_t i = 0; i < debris.size(); i++) {
+        debrisObjects.push_back(debris[i].attachBvh(sceneBvh));
+        sceneObjectNames.push_back(std::make_pair(debrisObjects.back(), "debris of " + filenames[i][0]));
+    }
+    sceneBvh.build();
+    std::cout << "Scene BVH: " << sceneBvh.getObjectCount() << " objects, " << sceneBvh.getNodeCount()
+        << " nodes" << std::endl;
+    std::vector<int> visibleObjects, nearbyObjects;
+    std::vector<unsigned char> sceneVisible;
+    size_t visibleObjectCount = 0;
+    OcclusionCuller occlusionCuller;
+    std::vector<std::pair<float, int>> occluderRanks;
+
+    // Level of detail choices summed over frames, printed every second
+    size_t lodDraws[MeshCache::MAX_LODS] = {};
+    size_t lodSaved[MeshCache::MAX_LODS] = {};
+    size_t drawCalls = 0;
+    size_t debrisDraws = 0;
+    int statFrames = 0;
+    double statStart = glfwGetTime();
+#ifdef COUNT_ALLOCATIONS
+    // Heap allocations of the frames, the stats printing is left out
+    size_t frameAllocations = 0;
+    size_t allocationsBefore = heapAllocations;
+    // Frames run by the allocation check since textures finished streaming, and allocations counted after warmup
+    int checkedFrames = 0;
+    size_t checkedAllocations = 0;
+#endif
+    int exitCode = 0;
+
     /* Loop until the user closes the window */
     while (!glfwWindowShouldClose(window))
     {
+        // Advance texture uploads, finished textures replace their placeholders this frame
+        textureStreamer.update();
+
         /* Render here */
+        renderTarget.bind();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Change active camera based on mode
         if (isTopDown)
-            activeCamera = (Camera)orthoCam;
+            activeCamera = &orthoCam;
         else
-            activeCamera = (Camera)player.getActiveCamera();
+            activeCamera = &player.getActiveCamera();
 
-        /*** Draw skybox ***/
-        // Change filter color depending on perspective
-        if (player.isFPP() && !isTopDown) {
-            skybox.resetFilterColor(nvFilter);
-            skybox.draw(activeCamera.getViewMatrix(), 1);
+        // Upload camera and lights once for every program
+        frameUniforms.update(*activeCamera, directionLight, player.getFlashlight());
+
+        // Frustum of the active camera, tested by every model and debris instance below
+        frustumCuller.setPlanes(activeCamera->getFrustumPlanes());
+
+        // Rebuild matrices of moved enemies in one pass, then refit their boxes and collect those in the frustum
+        Model::updateTransformations(enemies);
+        player.getPlayer().updateBvh();
+        sceneBvh.refit();
+        if (useSceneBvh) {
+            sceneBvh.cullFrustum(frustumCuller, visibleObjects);
+            sceneVisible.assign(sceneBvh.getObjectCount(), 0);
+            for (int object : visibleObjects)
+                sceneVisible[object] = 1;
+            visibleObjectCount += visibleObjects.size();
         }
-        else {
-            skybox.resetFilterColor();
-            skybox.draw(activeCamera.getViewMatrix(), 0);
+
+        // Queue this view on the occlusion worker, then hide what the occluders covered in the last one
+        if (useSceneBvh && useOcclusionCulling) {
+            occlusionCuller.begin(activeCamera->getViewProjection(), sceneBvh.getObjectCount());
+
+            // Visible enemies largest on screen first
+            occluderRanks.clear();
+            for (int i = 0; i < 6; i++) {
+                if (!enemies[i].getOccluder() || !sceneVisible[enemies[i].getBvhObject()])
+                    continue;
+                glm::vec4 sphere = enemies[i].getWorldSphere();
+                float distance = glm::length(glm::vec3(sphere) - activeCamera->getPosition());
+                occluderRanks.push_back(std::make_pair(sphere.w / std::max(distance, 1e-3f), i));
+            }
+            std::sort(occluderRanks.rbegin(), occluderRanks.rend());
+            for (int i = 0; i < (int)occluderRanks.size() && i < maxOccluders; i++) {
+                Model& occluder = enemies[occluderRanks[i].second];
+                occlusionCuller.addOccluder(*occluder.getOccluder(), occluder.getTransformation());
+            }
+
+            for (int object : visibleObjects) {
+                glm::vec3 boundsMin, boundsMax;
+                sceneBvh.getObjectBounds(object, boundsMin, boundsMax);
+                occlusionCuller.addObject(object, boundsMin, boundsMax);
+            }
+            occlusionCuller.submit();
+
+            for (int object : visibleObjects)
+                if (!occlusionCuller.isVisible(object))
+                    sceneVisible[object] = 0;
         }
 
-        /*** Draw player submarine ***/
-        // Set shader
-        playerShader.useShaderProgram();
-        
-        // Get position of active camera
-        playerShader.sendVec3("cameraPos", activeCamera.getPosition());
-
-        // Direction light variables
-        playerShader.sendVec3("directionLight.direction", directionLight.getDirection());
-        playerShader.sendVec3("directionLight.color", directionLight.getColor());
-        playerShader.sendFloat("directionLight.strength", directionLight.getIntensity());
-        playerShader.sendFloat("directionLight.ambientStr", directionLight.getAmbientStr());
-        playerShader.sendVec3("directionLight.ambientColor", directionLight.getAmbientColor());
-        playerShader.sendFloat("directionLight.specStr", directionLight.getSpecStr());
-        playerShader.sendFloat("directionLight.specPhong", directionLight.getSpecPhong());
-
-        // Spot light variables
-        playerShader.sendVec3("pointLight.position", player.getFlashlight().getPos());
-        playerShader.sendVec3("pointLight.color", player.getFlashlight().getColor());
-        playerShader.sendFloat("pointLight.linear", player.getFlashlight().getLinear());
-        playerShader.sendFloat("pointLight.quadratic", player.getFlashlight().getQuadratic());
-        playerShader.sendFloat("pointLight.ambientStr", player.getFlashlight().getAmbientStr());
-        playerShader.sendVec3("pointLight.ambientColor", player.getFlashlight().getAmbientColor());
-        playerShader.sendFloat("pointLight.specStr", player.getFlashlight().getSpecStr());
-        playerShader.sendFloat("pointLight.specPhong", player.getFlashlight().getSpecPhong());
-
-        // Draw object model
-        playerShader.sendMat4("projection", activeCamera.getProjection());
-        playerShader.sendMat4("view", activeCamera.getViewMatrix());
+        /*** Draw skybox first, every pixel shades it before the models draw over it ***/
+        if (!skyboxLast)
+            drawSkybox();
+
+        /*** Queue player submarine ***/
+        glm::vec3 cameraPos = activeCamera->getPosition();
 
         // Draw player if in third-person view or in top view
-        if(!player.isFPP() || isTopDown)
-            player.getPlayer().draw(playerShader.getUniformLoc("transform"),
-                playerShader.getUniformLoc("tex0"),
-                playerShader.getUniformLoc("tex1"));
+        if((!player.isFPP() || isTopDown) && (!useSceneBvh || sceneVisible[playerObject]))
+            player.getPlayer().submit(renderQueue, playerShader, cameraPos);
         
-        /*** Draw debris (NPCs) ***/
+        /*** Queue debris (NPCs) ***/
         npcShader.useShaderProgram();
 
-        // Get position of active camera
-        npcShader.sendVec3("cameraPos", activeCamera.getPosition());
-
-        // Direction light variables
-        npcShader.sendVec3("directionLight.direction", directionLight.getDirection());
-        npcShader.sendVec3("directionLight.color", directionLight.getColor());
-        npcShader.sendFloat("directionLight.strength", directionLight.getIntensity());
-        npcShader.sendFloat("directionLight.ambientStr", directionLight.getAmbientStr());
-        npcShader.sendVec3("directionLight.ambientColor", directionLight.getAmbientColor());
-        npcShader.sendFloat("directionLight.specStr", directionLight.getSpecStr());
-        npcShader.sendFloat("directionLight.specPhong", directionLight.getSpecPhong());
-
-        // Spot light variables
-        npcShader.sendVec3("pointLight.position", player.getFlashlight().getPos());
-        npcShader.sendVec3("pointLight.color", player.getFlashlight().getColor());
-        npcShader.sendFloat("pointLight.linear", player.getFlashlight().getLinear());
-        npcShader.sendFloat("pointLight.quadratic", player.getFlashlight().getQuadratic());
-        npcShader.sendFloat("pointLight.ambientStr", player.getFlashlight().getAmbientStr());
-        npcShader.sendVec3("pointLight.ambientColor", player.getFlashlight().getAmbientColor());
-        npcShader.sendFloat("pointLight.specStr", player.getFlashlight().getSpecStr());
-        npcShader.sendFloat("pointLight.specPhong", player.getFlashlight().getSpecPhong());
-
-        npcShader.sendMat4("projection", activeCamera.getProjection());
-        npcShader.sendMat4("view", activeCamera.getViewMatrix());
-
         // Change model color depending on perspective
         if (player.isFPP() && !isTopDown) {
-            npcShader.sendVec4("filterColor", nvFilter);
-            npcShader.sendInt("isFPP", 1);
+            npcShader.send(filterColorUniform, nvFilter);
+            npcShader.send(isFPPUniform, 1);
         }
         else
-            npcShader.sendInt("isFPP", 0);
+            npcShader.send(isFPPUniform, 0);
 
-        //Draw enemy models
-        for (int i = 0; i < 6; i++)
-            enemies[i].draw(npcShader.getUniformLoc("transform"),
-                npcShader.getUniformLoc("tex0"));
+        // Without the hierarchy, cull enemy models by their bounding spheres, then by the boxes of those left
+        if (!useSceneBvh) {
+            enemySpheres.clear();
+            for (int i = 0; i < 6; i++)
+                enemySpheres.add(enemies[i].getWorldSphere());
+            frustumCuller.cullSpheres(enemySpheres, enemyVisible);
+        }
+
+        //Queue visible enemy models at the level of detail their screen size needs
+        for (int i = 0; i < 6; i++) {
+            if (useSceneBvh) {
+                if (!sceneVisible[enemies[i].getBvhObject()])
+                    continue;
+            }
+            else {
+                glm::vec3 boundsMin, boundsMax;
+                enemies[i].getWorldBounds(boundsMin, boundsMax);
+                if (!enemyVisible[i] || !frustumCuller.refineBox(boundsMin, boundsMax))
+                    continue;
+            }
+
+            enemies[i].selectLod(activeCamera->getProjection(), cameraPos, screenHeight);
+            int level = enemies[i].getLodLevel();
+            lodDraws[level]++;
+            lodSaved[level] += enemies[i].getTriangleCount() - enemies[i].getTriangleCount(level);
+
+            enemies[i].submit(renderQueue, npcShader, cameraPos);
+            drawCalls += enemies[i].getDrawCalls();
+        }
+
+        // Opaque models front-to-back grouped by state, matching draws become instanced calls
+        // Transparent ones are kept until the sky is drawn
+        renderQueue.flush(true);
+
+        /*** Draw stress scene debris ***/
+        if (!debris.empty()) {
+            debrisShader.useShaderProgram();
+            if (player.isFPP() && !isTopDown) {
+                debrisShader.send(filterColorUniform, nvFilter);
+                debrisShader.send(isFPPUniform, 1);
+            }
+            else
+                debrisShader.send(isFPPUniform, 0);
+
+            for (size_t i = 0; i < debris.size(); i++) {
+                if (useSceneBvh)
+                    debris[i].draw(debrisShader.getUniformLoc(tex0Uniform), &sceneVisible[debrisObjects[i]]);
+                else
+                    debris[i].draw(debrisShader.getUniformLoc(tex0Uniform), &frustumCuller);
+                debrisDraws += debris[i].getDrawCalls();
+            }
+        }
+
+        /*** Draw skybox last, at the far end of the depth range ***/
+        // Pixels the opaque models covered fail the depth test before the sky shader runs
+        if (skyboxLast)
+            drawSkybox();
+
+        // Transparent models over the sky, back-to-front
+        renderQueue.flush();
+
+        // Flag what does not fit the budget, least recently drawn first, and free it until it is drawn again
+        MemoryBudget::get().endFrame();
+        player.getPlayer().applyEvictions();
+        for (Model& enemy : enemies)
+            enemy.applyEvictions();
+
+#ifdef COUNT_ALLOCATIONS
+        size_t allocations = heapAllocations - allocationsBefore;
+        frameAllocations += allocations;
+
+        // Count from the first frame without streaming, once the containers had the warmup frames to grow
+        if (checkFrameAllocations && (checkedFrames > 0 || !textureStreamer.isStreaming())) {
+            checkedFrames++;
+            if (checkedFrames > allocationWarmupFrames)
+                checkedAllocations += allocations;
+            if (checkedFrames == allocationWarmupFrames + allocationCheckFrames) {
+                if (checkedAllocations == 0)
+                    std::cout << "Frame allocation check passed: 0 heap allocations in " << allocationCheckFrames
+                        << " frames" << std::endl;
+                else {
+                    std::cout << "Frame allocation check FAILED: " << checkedAllocations << " heap allocations in "
+                        << allocationCheckFrames << " frames" << std::endl;
+                    exitCode = 1;
+                }
+                break;
+            }
+        }
+#endif
+
+        // Print average level of detail choices per frame
+        statFrames++;
+        if (glfwGetTime() - statStart >= 1.0) {
+            std::cout << "LOD per frame:";
+            for (int level = 0; level < MeshCache::MAX_LODS; level++)
+                std::cout << " LOD" << level << " " << (float)lodDraws[level] / statFrames
+                    << " draws, " << lodSaved[level] / statFrames << " tris saved;";
+            std::cout << " enemy draw calls " << (float)drawCalls / statFrames << std::endl;
+
+            // Driver uniform calls per frame, lookups are 0 with cached locations
+            ShaderManager::CallCounts& uniformCalls = ShaderManager::getCallCounts();
+            std::cout << "Uniform calls per frame: " << (float)uniformCalls.uploads / statFrames << " glUniform, "
+                << (float)uniformCalls.lookups / statFrames << " glGetUniformLocation, "
+                << (float)uniformCalls.blockUpdates / statFrames << " uniform buffer updates" << std::endl;
+            uniformCalls = ShaderManager::CallCounts();
+
+            // Binds and state changes per frame, skipped ones matched the tracked state
+            GLState::Counts& stateCalls = GLState::getCurrent().getCounts();
+            std::cout << "GL state calls per frame: " << (float)stateCalls.issued / statFrames << " issued, "
+                << (float)stateCalls.skipped / statFrames << " skipped" << std::endl;
+            stateCalls = GLState::Counts();
+
+            // Queued items against the draw calls issued for them after merging
+            RenderQueue::Stats& queueStats = renderQueue.getStats();
+            std::cout << "Render queue per frame: " << (float)queueStats.items / statFrames << " items, "
+                << (float)queueStats.drawCalls / statFrames << " draw calls, "
+                << (float)queueStats.stateChanges / statFrames << " state changes, "
+                << queueStats.sortMs / statFrames << " ms sorting" << std::endl;
+            queueStats = RenderQueue::Stats();
+
+            // Bounding volumes tested against the frustum and let through
+            FrustumCuller::Stats& cullStats = frustumCuller.getStats();
+            SceneBVH::Stats& bvhStats = sceneBvh.getStats();
+            if (useSceneBvh)
+                std::cout << "Frustum culling per frame: " << (float)visibleObjectCount / statFrames << " of "
+                    << sceneBvh.getObjectCount() << " objects visible, " << (float)bvhStats.nodesVisited / statFrames
+                    << " nodes visited, " << (float)bvhStats.objectsTested / statFrames << " boxes tested, "
+                    << bvhStats.refits << " refits, " << bvhStats.rebuilds << " rebuilds" << std::endl;
+            else
+                std::cout << "Frustum culling per frame: " << (float)cullStats.tested / statFrames << " tested, "
+                    << (float)cullStats.visible / statFrames << " visible, "
+                    << (float)(cullStats.tested - cullStats.visible) / statFrames << " culled" << std::endl;
+            cullStats = FrustumCuller::Stats();
+            bvhStats = SceneBVH::Stats();
+            visibleObjectCount = 0;
+
+            // Frustum visible objects the occluders hid, averaged over the frames the worker finished
+            OcclusionCuller::Stats& occlusionStats = occlusionCuller.getStats();
+            if (occlusionStats.frames > 0) {
+                float occlusionFrames = (float)occlusionStats.frames;
+                std::cout << "Occlusion culling per frame: " << occlusionStats.rejected / occlusionFrames << " of "
+                    << occlusionStats.tested / occlusionFrames << " objects rejected, "
+                    << occlusionStats.triangles / occlusionFrames << " occluder triangles, "
+                    << occlusionStats.rasterMs / occlusionFrames << " ms rasterizing, "
+                    << occlusionStats.testMs / occlusionFrames << " ms testing" << std::endl;
+            }
+            occlusionStats = OcclusionCuller::Stats();
+
+            // Objects around the submarine, the submarine itself excluded
+            sceneBvh.querySphere(player.getPlayer().getPos(), 100.f, nearbyObjects);
+            std::cout << "Objects within 100 units of the submarine: "
+                << nearbyObjects.size() - std::count(nearbyObjects.begin(), nearbyObjects.end(), playerObject) << std::endl;
+
+            // Instanced draw calls against the frame time they allow
+            if (!debris.empty())
+                std::cout << "Stress scene per frame: " << (float)debrisDraws / statFrames << " draw calls, "
+                    << (glfwGetTime() - statStart) * 1000.0 / statFrames << " ms" << std::endl;
+            debrisDraws = 0;
+
+            // Resident bytes against the budget, and the assets it freed and uploaded again
+            MemoryBudget& budget = MemoryBudget::get();
+            MemoryBudget::Usage totalMemory = budget.getTotal();
+            std::cout << "Memory:";
+            for (int category = 0; category < MemoryBudget::CATEGORY_COUNT; category++) {
+                MemoryBudget::Usage usage = budget.getUsage((MemoryBudget::Category)category);
+                std::cout << " " << MemoryBudget::getCategoryName((MemoryBudget::Category)category) << " "
+                    << usage.cpuBytes / 1024 << " KB CPU, " << usage.gpuBytes / 1024 << " KB GPU;";
+            }
+            std::cout << " total " << totalMemory.gpuBytes / (1024 * 1024) << " of " << budget.getBudget() / (1024 * 1024)
+                << " MB GPU, " << budget.getStats().evictions << " evictions (" << budget.getStats().evictedBytes / 1024
+                << " KB), " << budget.getStats().restores << " restores" << std::endl;
+            budget.getStats() = MemoryBudget::Stats();
+
+            // Sky fragments shaded against the full screen drawing it first shades, for each view seen
+            float screenPixels = (float)framebufferWidth * framebufferHeight;
+            std::cout << "Skybox fragments per frame (drawn " << (skyboxLast ? "last" : "first") << "):";
+            for (int view = 0; view < 3; view++) {
+                SampleCounter::Stats& skyStats = skyFragments.getStats(view);
+                if (skyStats.spans == 0)
+                    continue;
+                float fragments = (float)skyStats.samples / skyStats.spans;
+                std::cout << " " << viewNames[view] << " " << (size_t)fragments << " of " << (size_t)screenPixels
+                    << " pixels, " << (1.f - fragments / screenPixels) * 100.f << "% saved;";
+                skyStats = SampleCounter::Stats();
+            }
+            std::cout << std::endl;
+
+#ifdef COUNT_ALLOCATIONS
+            // Zero once assets have streamed in and the containers reached their sizes
+            std::cout << "Heap allocations per frame: " << (float)frameAllocations / statFrames << std::endl;
+            frameAllocations = 0;
+#endif
+
+            drawCalls = 0;
+            std::fill(lodDraws, lodDraws + MeshCache::MAX_LODS, 0);
+            std::fill(lodSaved, lodSaved + MeshCache::MAX_LODS, 0);
+            statFrames = 0;
+            statStart = glfwGetTime();
+        }
+#ifdef COUNT_ALLOCATIONS
+        allocationsBefore = heapAllocations;
+#endif
         
         /* Swap front and back buffers */
+        renderTarget.present();
         glfwSwapBuffers(window);
 
         /* Poll for and process events */
@@ -287,10 +856,16 @@ int main(void)
     //Cleanup enemy models
     for (int i = 0; i < 6; i++)
         enemies[i].cleanup();
+    for (InstancedModel& pieces : debris)
+        pieces.cleanup();
     skybox.cleanup();
+    skyFragments.cleanup();
+    frameUniforms.cleanup();
+    textureStreamer.cleanup();
+    renderTarget.cleanup();
 
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
 
 void Key_Callback(GLFWwindow* window,
@@ -380,3 +955,255 @@ void CursorCallback(GLFWwindow* window, double xpos, double ypos) {
     orthoCam.panCamera(-sensitivity * (oldX - cursorX), -sensitivity * (oldY - cursorY));
 }
 
+
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int /*mods*/) {
+    // Right click in the top-down view picks the object under the cursor
+    if (!isTopDown || button != GLFW_MOUSE_BUTTON_RIGHT || action != GLFW_PRESS)
+        return;
+
+    double x, y;
+    int width, height;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    glm::vec2 ndc = glm::vec2(x / width * 2.0 - 1.0, 1.0 - y / height * 2.0);
+
+    // Ray from the near to the far plane under the cursor, distances along it run from 0 to 1
+    glm::mat4 unproject = glm::inverse(orthoCam.getViewProjection());
+    glm::vec4 nearPoint = unproject * glm::vec4(ndc, -1.f, 1.f);
+    glm::vec4 farPoint = unproject * glm::vec4(ndc, 1.f, 1.f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    float distance;
+    int object = sceneBvh.raycast(origin, direction, 1.f, &distance);
+    if (object < 0) {
+        std::cout << "Picked nothing" << std::endl;
+        return;
+    }
+
+    // Name of the id range holding the object
+    size_t range = 0;
+    while (range + 1 < sceneObjectNames.size() && sceneObjectNames[range + 1].first <= object)
+        range++;
+    std::cout << "Picked " << sceneObjectNames[range].second << " (object " << object << ") "
+        << distance * glm::length(direction) << " units below the camera" << std::endl;
+}
+
+void BenchmarkTangents(std::string objPath) {
+    tinyobj::attrib_t attributes;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warning, error;
+    if (!tinyobj::LoadObj(&attributes, &shapes, &materials, &warning, &error, objPath.c_str()))
+        return;
+
+    // Attribute lookup that tolerates missing normals and UVs
+    auto read = [](const std::vector<tinyobj::real_t>& values, int index, int size, int component) {
+        return index >= 0 && (size_t)(index + 1) * size <= values.size() ? values[(size_t)index * size + component] : 0.f;
+    };
+
+    // Runs a task several times and returns the fastest run
+    auto best = [](std::function<void()> task) {
+        double fastest = DBL_MAX;
+        for (int run = 0; run < 10; run++) {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            task();
+            fastest = std::min(fastest, std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - begin).count());
+        }
+        return fastest;
+    };
+
+    // Previous loader: flat tangent per face, pushed once per corner
+    double flatMs = best([&] {
+        std::vector<glm::vec3> tangents;
+        std::vector<glm::vec3> bitangents;
+        for (tinyobj::shape_t& shape : shapes)
+            for (size_t i = 0; i + 2 < shape.mesh.indices.size(); i += 3) {
+                glm::vec3 v[3];
+                glm::vec2 uv[3];
+                for (int corner = 0; corner < 3; corner++) {
+                    tinyobj::index_t vData = shape.mesh.indices[i + corner];
+                    for (int axis = 0; axis < 3; axis++)
+                        v[corner][axis] = read(attributes.vertices, vData.vertex_index, 3, axis);
+                    for (int axis = 0; axis < 2; axis++)
+                        uv[corner][axis] = read(attributes.texcoords, vData.texcoord_index, 2, axis);
+                }
+
+                glm::vec3 deltaPos1 = v[1] - v[0];
+                glm::vec3 deltaPos2 = v[2] - v[0];
+                glm::vec2 deltaUV1 = uv[1] - uv[0];
+                glm::vec2 deltaUV2 = uv[2] - uv[0];
+                float r = 1.f / ((deltaUV1.x * deltaUV2.y) - deltaUV1.y * deltaUV2.x);
+
+                glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
+                glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+                for (int corner = 0; corner < 3; corner++) {
+                    tangents.push_back(tangent);
+                    bitangents.push_back(bitangent);
+                }
+            }
+    });
+
+    // Welded vertices that the generator runs on at load
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    {
+        VertexWelder welder(vertices, 14);
+        for (tinyobj::shape_t& shape : shapes)
+            for (size_t i = 0; i < shape.mesh.indices.size() / 3 * 3; i++) {
+                tinyobj::index_t vData = shape.mesh.indices[i];
+                GLfloat vertex[14] = {};
+                for (int axis = 0; axis < 3; axis++) {
+                    vertex[axis] = read(attributes.vertices, vData.vertex_index, 3, axis);
+                    vertex[3 + axis] = read(attributes.normals, vData.normal_index, 3, axis);
+                }
+                for (int axis = 0; axis < 2; axis++)
+                    vertex[6 + axis] = read(attributes.texcoords, vData.texcoord_index, 2, axis);
+                indices.push_back(welder.add(vertex));
+            }
+    }
+    size_t vertexCount = vertices.size() / 14;
+    unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    double scalarMs = best([&] {
+        TangentGenerator::generate(vertices.data(), vertexCount, 14, indices, 1, false);
+    });
+    double simdMs = best([&] {
+        TangentGenerator::generate(vertices.data(), vertexCount, 14, indices, 1, true);
+    });
+    double parallelMs = best([&] {
+        TangentGenerator::generate(vertices.data(), vertexCount, 14, indices, threadCount, true);
+    });
+
+    std::cout << "  " << objPath << ": " << indices.size() / 3 << " tris, " << vertexCount << " vertices, per-face "
+        << flatMs << " ms, scalar " << scalarMs << " ms, " << (TangentGenerator::hasSimd() ? "SSE " : "scalar ")
+        << simdMs << " ms, " << threadCount << " threads " << parallelMs << " ms ("
+        << flatMs / parallelMs << "x)" << std::endl;
+}
+
+void BenchmarkBvh() {
+    std::cout << "Scene BVH (build, refit after 1% and 100% of objects move, frustum culling against "
+        << "flat sphere tests, 1000 rays, 1000 proximity spheres)" << std::endl;
+
+    // Camera in the middle of the objects, looking down -Z
+    PerspectiveCamera camera = PerspectiveCamera(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0), true);
+    FrustumCuller culler;
+    culler.setPlanes(camera.getFrustumPlanes());
+
+    int counts[3] = { 1000, 10000, 100000 };
+    for (int c = 0; c < 3; c++) {
+        int count = counts[c];
+        // Same density at every count, boxes 1 to 5 units wide
+        float side = 20.f * std::cbrt((float)count);
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        auto randomPoint = [&] {
+            return (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * side;
+        };
+
+        SceneBVH bvh;
+        FrustumCuller::SphereSet spheres;
+        std::vector<glm::vec3> centers, halfSizes;
+        for (int i = 0; i < count; i++) {
+            centers.push_back(randomPoint());
+            halfSizes.push_back(glm::vec3(0.5f + unit(random) * 2.f));
+            bvh.insert(centers[i] - halfSizes[i], centers[i] + halfSizes[i]);
+            spheres.add(glm::vec4(centers[i], glm::length(halfSizes[i])));
+        }
+
+        auto time = [](std::function<void()> task) {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            task();
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        };
+        auto move = [&](int object) {
+            centers[object] += (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 2.f;
+            bvh.update(object, centers[object] - halfSizes[object], centers[object] + halfSizes[object]);
+        };
+
+        double buildMs = time([&] { bvh.build(); });
+        for (int i = 0; i < count / 100; i++)
+            move((int)(unit(random) * (count - 1)));
+        double refitFewMs = time([&] { bvh.refit(); });
+        for (int i = 0; i < count; i++)
+            move(i);
+        double refitAllMs = time([&] { bvh.refit(); });
+
+        std::vector<int> results;
+        std::vector<unsigned char> flags;
+        double frustumMs = time([&] { bvh.cullFrustum(culler, results); });
+        size_t visible = results.size();
+        double flatMs = time([&] { culler.cullSpheres(spheres, flags); });
+
+        std::vector<glm::vec3> rayOrigins, rayDirections;
+        for (int i = 0; i < 1000; i++) {
+            rayOrigins.push_back(randomPoint());
+            rayDirections.push_back(glm::normalize(randomPoint() + glm::vec3(0.001f)));
+        }
+        int hits = 0;
+        double rayMs = time([&] {
+            for (int i = 0; i < 1000; i++)
+                hits += bvh.raycast(rayOrigins[i], rayDirections[i], side) >= 0;
+        });
+        size_t nearby = 0;
+        double sphereMs = time([&] {
+            for (int i = 0; i < 1000; i++) {
+                bvh.querySphere(rayOrigins[i], 20.f, results);
+                nearby += results.size();
+            }
+        });
+
+        std::cout << "  " << count << " objects, " << bvh.getNodeCount() << " nodes: build " << buildMs
+            << " ms, refit " << refitFewMs << " / " << refitAllMs << " ms (" << bvh.getStats().rebuilds - 1
+            << " rebuilds), frustum " << frustumMs << " ms for " << visible << " visible (flat " << flatMs
+            << " ms), rays " << rayMs << " ms for " << hits << " hits, spheres " << sphereMs << " ms for "
+            << nearby << " objects" << std::endl;
+    }
+}
+
+void BenchmarkTransforms() {
+    std::cout << "Model transforms (rebuild after every model moved, models in a scene hierarchy, best of 10 runs)"
+        << std::endl;
+
+    int counts[2] = { 1000, 10000 };
+    for (int c = 0; c < 2; c++) {
+        std::vector<Model> models(counts[c]);
+        std::mt19937 random(11);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        for (size_t i = 0; i < models.size(); i++) {
+            models[i].setPosition((glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 100.f);
+            if (i % 2)
+                models[i].setPivotOrigin();
+        }
+        // Attached like the scene models, whose moves must stay dirty until the batch
+        SceneBVH bvh;
+        for (Model& model : models)
+            model.attachBvh(bvh);
+        bvh.build();
+
+        // Moves every model, then times the rebuild
+        auto best = [&](std::function<void()> rebuild) {
+            double fastest = DBL_MAX;
+            for (int run = 0; run < 10; run++) {
+                for (Model& model : models)
+                    model.adjustRotate(glm::vec3(1.f, 2.f, 3.f));
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                rebuild();
+                fastest = std::min(fastest, std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - begin).count());
+                bvh.refit();
+            }
+            return fastest;
+        };
+
+        double scalarMs = best([&] { Model::updateTransformations(models, false); });
+        double simdMs = best([&] { Model::updateTransformations(models, true); });
+        std::chrono::steady_clock::time_point cleanStart = std::chrono::steady_clock::now();
+        Model::updateTransformations(models);
+        double cleanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cleanStart).count();
+
+        std::cout << "  " << counts[c] << " models: scalar " << scalarMs << " ms, SSE " << simdMs
+            << " ms, nothing moved " << cleanMs << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,250 @@
+/* Bakes the assets under 3D/, Skybox/ and Shaders/ into one asset pack
+*  Usage: packer [output]    (default "assets.pack", run from the project folder)
+*
+*  OBJ files are processed exactly like the game loads them and stored as mesh
+*  cache images, once in the plain layout and once with tangents if a
+*  "<name>_normal.png" sits next to them. Images are decoded and stored with
+*  a box filtered mip chain, skybox faces unflipped and without mips as the
+*  skybox samples them. Shader sources are stored as text. Rebuild the pack
+*  after changing any of these files, the game does not check them against it.
+*/
+
+// Platform file mapping and directory listing
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
+#include <glad/glad.h>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <queue>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+using namespace std;
+
+// SSE intrinsics where the target guarantees them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/packing.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "Classes/GLState.h"
+#include "Classes/GLHandle.h"
+#include "Classes/ThreadPool.h"
+#include "Classes/AssetLoader.h"
+#include "Classes/MappedFile.h"
+#include "Classes/AssetPack.h"
+#include "Classes/Image.h"
+#include "Classes/TextureStreamer.h"
+#include "Classes/MemoryBudget.h"
+#include "Classes/ShaderManager.h"
+#include "Classes/MeshOptimizer.h"
+#include "Classes/MeshSimplifier.h"
+#include "Classes/MeshCache.h"
+#include "Classes/VertexWelder.h"
+#include "Classes/VertexPacker.h"
+#include "Classes/TangentGenerator.h"
+#include "Classes/RenderQueue.h"
+#include "Classes/FrustumCuller.h"
+#include "Classes/SceneBVH.h"
+#include "Classes/OcclusionCuller.h"
+#include "Classes/Model.h"
+
+// Function declarations
+std::vector<std::string> ListFiles(std::string directory);
+std::string GetExtension(std::string path);
+bool AddMesh(AssetPack::Writer& pack, std::string path, bool useNormals);
+bool AddTexture(AssetPack::Writer& pack, std::string path, bool skybox);
+bool AddShader(AssetPack::Writer& pack, std::string path);
+
+int main(int argc, char** argv)
+{
+    std::string output = argc > 1 ? argv[1] : "assets.pack";
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    AssetPack::Writer pack;
+    if (!pack.open(output)) {
+        std::cout << "Cannot write " << output << std::endl;
+        return 1;
+    }
+
+    std::string directories[3] = { "3D", "Skybox", "Shaders" };
+    int failed = 0;
+    for (int d = 0; d < 3; d++) {
+        std::vector<std::string> files = ListFiles(directories[d]);
+        for (std::string& path : files) {
+            std::string extension = GetExtension(path);
+            bool added = true;
+            if (extension == "obj") {
+                // Models with a normal map are loaded with tangents
+                std::string normalPath = path.substr(0, path.size() - 4) + "_normal.png";
+                std::ifstream normalMap(normalPath);
+                added = AddMesh(pack, path, false);
+                if (normalMap)
+                    added = AddMesh(pack, path, true) && added;
+            }
+            else if (extension == "png" || extension == "jpg" || extension == "jpeg")
+                added = AddTexture(pack, path, d == 1);
+            else if (extension == "vert" || extension == "frag")
+                added = AddShader(pack, path);
+            else
+                continue;
+
+            if (!added) {
+                std::cout << "  " << path << ": failed" << std::endl;
+                failed++;
+            }
+        }
+    }
+
+    if (!pack.finish()) {
+        std::cout << "Cannot write " << output << std::endl;
+        return 1;
+    }
+    std::cout << output << ": " << pack.getEntryCount() << " entries, " << pack.getSize() / 1024 << " KB in "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms"
+        << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+/* Returns paths of the files in a directory, sorted so packs are reproducible */
+std::vector<std::string> ListFiles(std::string directory) {
+    std::vector<std::string> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((directory + "\\*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE)
+        return files;
+    do {
+        if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            files.push_back(directory + "/" + found.cFileName);
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return files;
+    while (dirent* found = readdir(dir)) {
+        std::string path = directory + "/" + found->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            files.push_back(path);
+    }
+    closedir(dir);
+#endif
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+/* Returns the lowercase extension of a path without the dot */
+std::string GetExtension(std::string path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos)
+        return "";
+    std::string extension = path.substr(dot + 1);
+    for (char& c : extension)
+        c = (char)std::tolower((unsigned char)c);
+    return extension;
+}
+
+/* Processes an OBJ like the game does and adds its mesh cache image */
+bool AddMesh(AssetPack::Writer& pack, std::string path, bool useNormals) {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!MeshCache::statSource(path, sourceSize, sourceTime))
+        return false;
+
+    Model model(path, "", GL_RGB, useNormals, "", GL_RGB, glm::vec3(0), 1.f, glm::vec3(0));
+    if (model.getVertexCount() == 0)
+        return false;
+
+    std::ostringstream image(std::ios::binary);
+    if (!MeshCache::write(image, model.getOffset(), model.getMeshData(), sourceSize, sourceTime))
+        return false;
+
+    std::string data = image.str();
+    AssetPack::Entry entry = {};
+    entry.type = AssetPack::MESH;
+    entry.layout = (uint32_t)model.getOffset();
+    pack.add(entry, path, data.data(), data.size());
+    std::cout << "  " << path << ": " << model.getVertexCount() << " vertices, " << model.getOffset()
+        << " floats per vertex, " << data.size() / 1024 << " KB" << std::endl;
+    return true;
+}
+
+/* Decodes an image and adds its pixels followed by a box filtered mip chain */
+bool AddTexture(AssetPack::Writer& pack, std::string path, bool skybox) {
+    Image image;
+    bool flip = !skybox;
+    if (!image.load(path, flip))
+        return false;
+
+    // Skybox faces are sampled without mips
+    if (!skybox)
+        image.buildMipChain();
+
+    AssetPack::Entry entry = {};
+    entry.type = AssetPack::TEXTURE;
+    entry.layout = (uint32_t)image.getChannels();
+    entry.width = (uint32_t)image.getWidth();
+    entry.height = (uint32_t)image.getHeight();
+    entry.levels = (uint32_t)image.getLevels();
+    entry.flipped = flip ? 1 : 0;
+    pack.add(entry, path, image.getPixels(), image.getSize());
+    std::cout << "  " << path << ": " << image.getWidth() << "x" << image.getHeight() << "x" << image.getChannels()
+        << ", " << image.getLevels() << " levels, " << image.getSize() / 1024 << " KB" << std::endl;
+    return true;
+}
+
+/* Adds a shader source as text */
+bool AddShader(AssetPack::Writer& pack, std::string path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::stringstream source;
+    source << file.rdbuf();
+
+    std::string text = source.str();
+    AssetPack::Entry entry = {};
+    entry.type = AssetPack::SHADER;
+    pack.add(entry, path, text.data(), text.size());
+    std::cout << "  " << path << ": " << text.size() << " bytes" << std::endl;
+    return true;
+}